@@ -1,63 +1,1136 @@
 // allocator.cpp
 
 #include "allocator.h"
+#include "span_init.h"
 #include <sys/mman.h> // For mmap, munmap
+#include <sys/syscall.h> // For SYS_getcpu, SYS_mbind
+#include <linux/mempolicy.h> // For MPOL_PREFERRED
+#include <fcntl.h>    // For open
+#include <unistd.h>   // For read, close, syscall
+#include <sched.h>    // For sched_yield
+#include <pthread.h>  // For pthread_atfork
+#include <time.h>     // For clock_gettime
 #include <cassert>    // For assert
 #include <cstdlib>    // For std::malloc and std::free
 #include <iostream>   // For debug output
+#include <cstdarg>    // For va_list in the metrics writer
+#include <cstdio>     // For vsnprintf
 #include <algorithm>  // For std::min
+#include <cstring>    // For memset
+#include <cstdint>    // For uintptr_t, SIZE_MAX
+#include <vector>     // For compact()'s span order
+#ifdef __SSE2__
+#include <emmintrin.h> // For non-temporal stores
+#endif
 
 // --- Static and Global Variables ---
-static thread_local MyAllocator::ThreadCache my_cache;
 static const size_t PAGE_SHIFT = 12; // 2^12 = 4096 (4KB)
-const size_t SIZE_CLASSES[] = {8, 16, 32, 64, 128, 256, 512, 1024};
-constexpr size_t MAX_SMALL_ALLOC_SIZE = 1024;
-constexpr int SCAVENGE_THRESHOLD = 128;
+constexpr size_t NT_MEMSET_THRESHOLD = 256 * 1024; // Beyond typical L2 size
+constexpr unsigned BUDGET_SOFT = 1; // ThreadCache::budget_events bits
+constexpr unsigned BUDGET_HARD = 2;
 
 // Global span allocator to avoid recursion
 static char span_memory[4096 * 10]; // Pre-allocated memory for spans
+static char* span_region = span_memory; // Region currently being carved
+static size_t span_region_size = sizeof(span_memory);
 static size_t span_offset = 0;
+constexpr size_t SPAN_CHUNK_SIZE = 64 * 1024; // Overflow regions come straight from mmap
 static std::mutex span_alloc_mutex;
+static void* recycled_spans = nullptr; // Intrusive list of returned span records
 
 static void* allocate_span_memory(size_t size) {
     std::lock_guard<std::mutex> lock(span_alloc_mutex);
-    if (span_offset + size > sizeof(span_memory)) {
-        return nullptr; // Out of pre-allocated span memory
+    if (recycled_spans != nullptr && size == sizeof(MyAllocator::Span)) {
+        void* ptr = recycled_spans;
+        recycled_spans = *(void**)ptr;
+        return ptr;
     }
-    void* ptr = span_memory + span_offset;
+    if (span_offset + size > span_region_size) {
+        // Out of pre-allocated span memory: continue in a fresh mapping
+        void* chunk = mmap(nullptr, SPAN_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED) return nullptr;
+        span_region = (char*)chunk;
+        span_region_size = SPAN_CHUNK_SIZE;
+        span_offset = 0;
+    }
+    void* ptr = span_region + span_offset;
     span_offset += size;
     return ptr;
 }
 
-// --- Helper Function Implementations ---
-size_t MyAllocator::getSizeClassIndex(size_t size) {
+static void release_span_memory(MyAllocator::Span* span) {
+    std::lock_guard<std::mutex> lock(span_alloc_mutex);
+    *(void**)span = recycled_spans;
+    recycled_spans = span;
+}
+
+// Trace file shared by all threads, -1 when tracing is off
+static std::atomic<int> trace_fd{-1};
+static void stopTraceInChild();
+
+// Live allocator instances, walked by the fork handlers
+static MyAllocator* instance_list = nullptr;
+static std::mutex instance_mutex;
+
+// Bumped by trim(); a thread whose ThreadCache::flush_epoch lags behind
+// flushes its cache at its next refill or scavenge.
+static std::atomic<unsigned> flush_requests{0};
+
+// Thread statistics registry. Live threads are summed on demand; a thread's
+// counts move to retired_stats when it exits.
+static std::mutex stats_mutex;
+static MyAllocator::ThreadCounters* thread_registry = nullptr;
+static MyAllocator::ClassStats retired_stats[8];
+
+// --- Construction and Fork Safety ---
+// Lock order is: instance registry -> every TransferCache and long-lived
+// pool -> every frame pool -> every movable pool -> the handle table -> every
+// PageHeap -> span metadata. This matches the nesting on the refill path
+// (TransferCache, then PageHeap, then span metadata) so prepareFork can
+// never deadlock against a thread that is mid-allocation.
+MyAllocator::MyAllocator() {
+    static std::once_flag atfork_once;
+    std::call_once(atfork_once, [] {
+        pthread_atfork(&MyAllocator::prepareFork, &MyAllocator::resumeAfterFork,
+                       &MyAllocator::resumeAfterForkChild);
+    });
+
+    loadTunablesFromEnv();
+#ifdef MYALLOC_TRACING
+    const char* trace_path = getenv("MYALLOC_TRACE");
+    if (trace_path != nullptr && trace_fd.load() < 0) startTrace(trace_path);
+#endif
+
+    std::lock_guard<std::mutex> lock(instance_mutex);
+    next_instance = instance_list;
+    instance_list = this;
+}
+
+MyAllocator::~MyAllocator() {
+    std::lock_guard<std::mutex> lock(instance_mutex);
+    for (MyAllocator** link = &instance_list; *link; link = &(*link)->next_instance) {
+        if (*link == this) {
+            *link = next_instance;
+            break;
+        }
+    }
+}
+
+void MyAllocator::lockAll() {
+    for (NodeArena& arena : arenas) {
+        for (TransferCache& tc : arena.transfer_caches) tc.mtx.lock();
+        for (TransferCache& pool : arena.long_lived) pool.mtx.lock();
+    }
+    for (FramePool& pool : frame_pools) pool.mtx.lock();
+    for (MovablePool& pool : movable_pools) pool.mtx.lock();
+    handle_mtx.lock();
+    for (NodeArena& arena : arenas) arena.page_heap.mtx.lock();
+    for (NodeArena& arena : arenas) arena.large_cache.mtx.lock();
+}
+
+void MyAllocator::unlockAll() {
+    for (NodeArena& arena : arenas) arena.large_cache.mtx.unlock();
+    for (NodeArena& arena : arenas) arena.page_heap.mtx.unlock();
+    handle_mtx.unlock();
+    for (MovablePool& pool : movable_pools) pool.mtx.unlock();
+    for (FramePool& pool : frame_pools) pool.mtx.unlock();
+    for (NodeArena& arena : arenas) {
+        for (TransferCache& pool : arena.long_lived) pool.mtx.unlock();
+        for (TransferCache& tc : arena.transfer_caches) tc.mtx.unlock();
+    }
+}
+
+void MyAllocator::prepareFork() {
+    instance_mutex.lock();
+    for (MyAllocator* a = instance_list; a; a = a->next_instance) a->lockAll();
+    span_alloc_mutex.lock();
+    stats_mutex.lock();
+}
+
+// Runs in both parent and child. In the child the forking thread is the only
+// thread and already owns every lock, so releasing them restores a usable heap.
+void MyAllocator::resumeAfterFork() {
+    stats_mutex.unlock();
+    span_alloc_mutex.unlock();
+    for (MyAllocator* a = instance_list; a; a = a->next_instance) a->unlockAll();
+    instance_mutex.unlock();
+}
+
+void MyAllocator::resumeAfterForkChild() {
+    resumeAfterFork();
+    // The child must not append the parent's buffered records (or its own)
+    // to the parent's trace file.
+    stopTraceInChild();
+}
+
+// --- Statistics ---
+// Returns everything the exiting thread still caches to its owner, if that
+// allocator still exists, so the blocks are not stranded in dead TLS.
+struct MyAllocator::ThreadExitHook {
+    bool armed = false;
+    ~ThreadExitHook() {
+        if (!armed) return;
+        {
+            std::lock_guard<std::mutex> lock(instance_mutex);
+            for (MyAllocator* a = instance_list; a; a = a->next_instance) {
+                if (a == my_cache.owner) a->flushThreadCache();
+            }
+        }
+        unregisterThread();
+    }
+};
+thread_local MyAllocator::ThreadExitHook MyAllocator::thread_exit_hook;
+
+void MyAllocator::registerThread() {
+    my_cache.owner = this;
+    thread_exit_hook.armed = true;
+    ThreadCounters* counters = &my_cache.counters;
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    counters->prev_thread = nullptr;
+    counters->next_thread = thread_registry;
+    if (thread_registry) thread_registry->prev_thread = counters;
+    thread_registry = counters;
+}
+
+void MyAllocator::unregisterThread() {
+    ThreadCounters* counters = &my_cache.counters;
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    for (size_t i = 0; i < 8; ++i) {
+        retired_stats[i].fast_path_hits += counters->fast_path_hits[i].load(std::memory_order_relaxed);
+        retired_stats[i].transfer_fetches += counters->transfer_fetches[i].load(std::memory_order_relaxed);
+        retired_stats[i].page_heap_refills += counters->page_heap_refills[i].load(std::memory_order_relaxed);
+        retired_stats[i].blocks_carved += counters->blocks_carved[i].load(std::memory_order_relaxed);
+        retired_stats[i].scavenges += counters->scavenges[i].load(std::memory_order_relaxed);
+    }
+    if (counters->prev_thread) counters->prev_thread->next_thread = counters->next_thread;
+    else thread_registry = counters->next_thread;
+    if (counters->next_thread) counters->next_thread->prev_thread = counters->prev_thread;
+}
+
+void MyAllocator::ProfiledMutex::addTo(LockStats& stats) const {
+    stats.samples += samples.load(std::memory_order_relaxed);
+    stats.contended += contended_samples.load(std::memory_order_relaxed);
+    stats.wait_cycles += wait_cycles.load(std::memory_order_relaxed);
+    stats.hold_cycles += hold_cycles.load(std::memory_order_relaxed);
+}
+
+// --- Heap Hardening ---
+#ifdef MYALLOC_HARDENED
+void MyAllocator::reportHeapCorruption(const char* what, const void* ptr) {
+    char buf[160];
+    size_t len = 0;
+    for (const char* s = "MyAllocator: "; *s; ++s) buf[len++] = *s;
+    for (const char* s = what; *s && len < 120; ++s) buf[len++] = *s;
+    for (const char* s = " at 0x"; *s; ++s) buf[len++] = *s;
+    for (int shift = 60; shift >= 0; shift -= 4) {
+        buf[len++] = "0123456789abcdef"[((uintptr_t)ptr >> shift) & 0xf];
+    }
+    buf[len++] = '\n';
+    ssize_t ignored = write(STDERR_FILENO, buf, len);
+    (void)ignored;
+    abort();
+}
+
+static uintptr_t generateHeapSecret() {
+    uintptr_t secret = 0;
+    if (syscall(SYS_getrandom, &secret, sizeof(secret), 0) != (long)sizeof(secret)) {
+        secret = (uintptr_t)&secret * 0x9E3779B97F4A7C15ULL ^ (uintptr_t)__builtin_ia32_rdtsc();
+    }
+    return secret;
+}
+
+// Per-process key for free-list links; initialised on first use so blocks
+// linked before main() are encoded with the same value.
+uintptr_t MyAllocator::heapSecret() {
+    static const uintptr_t secret = generateHeapSecret();
+    return secret;
+}
+
+// Value written into the first user word of a freed block.
+uintptr_t MyAllocator::freeCanary(const void* header) {
+    return heapSecret() ^ (uintptr_t)header ^ 0xF5EEB10CF5EEB10CULL;
+}
+#endif
+
+// Zero-fills memory, bypassing the cache for buffers too large to stay in it.
+static void zeroFill(void* ptr, size_t size) {
+#ifdef __SSE2__
+    if (size >= NT_MEMSET_THRESHOLD) {
+        char* p = (char*)ptr;
+        char* aligned = (char*)(((uintptr_t)p + 15) & ~(uintptr_t)15);
+        char* end = p + size;
+        char* aligned_end = (char*)((uintptr_t)end & ~(uintptr_t)15);
+        memset(p, 0, aligned - p);
+        __m128i zero = _mm_setzero_si128();
+        for (char* q = aligned; q < aligned_end; q += 16) {
+            _mm_stream_si128((__m128i*)q, zero);
+        }
+        _mm_sfence();
+        memset(aligned_end, 0, end - aligned_end);
+        return;
+    }
+#endif
+    memset(ptr, 0, size);
+}
+
+// --- NUMA Topology ---
+// Parses /sys/devices/system/node/online (e.g. "0" or "0-1,3") with raw
+// syscalls so that no allocation happens while the allocator bootstraps.
+static int detectNumaNodeCount() {
+    int fd = open("/sys/devices/system/node/online", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 1;
+    char buf[128];
+    ssize_t len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) return 1;
+    buf[len] = '\0';
+
+    int highest = 0;
+    int value = 0;
+    for (ssize_t i = 0; i <= len; ++i) {
+        if (buf[i] >= '0' && buf[i] <= '9') {
+            value = value * 10 + (buf[i] - '0');
+        } else {
+            if (value > highest) highest = value;
+            value = 0;
+        }
+    }
+    return std::min(highest + 1, MyAllocator::MAX_NUMA_NODES);
+}
+
+int MyAllocator::numaNodeCount() {
+    static const int count = detectNumaNodeCount();
+    return count;
+}
+
+int MyAllocator::currentNode() {
+    if (my_cache.node >= 0) return my_cache.node;
+    unsigned cpu = 0, node = 0;
+    if (numaNodeCount() == 1 || syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        node = 0;
+    }
+    my_cache.node = (int)(node % numaNodeCount());
+    registerThread(); // First allocator call on this thread
+    return my_cache.node;
+}
+
+MyAllocator::Stats MyAllocator::getStats() const {
+    Stats stats;
+    stats.numa_nodes = numaNodeCount();
+    stats.cross_node_frees = cross_node_frees.load(std::memory_order_relaxed);
+    stats.mapped_bytes = mapped_bytes.load(std::memory_order_relaxed);
+    stats.soft_limit_events = soft_limit_events.load(std::memory_order_relaxed);
+    stats.hard_limit_failures = hard_limit_failures.load(std::memory_order_relaxed);
+    stats.large_cache_bytes = 0;
+    for (const NodeArena& arena : arenas) {
+        stats.large_cache_bytes += arena.large_cache.bytes.load(std::memory_order_relaxed);
+    }
+
+    stats.small_span_bytes = small_span_bytes.load(std::memory_order_relaxed);
+    stats.frame_span_bytes = frame_span_bytes.load(std::memory_order_relaxed);
+    stats.cache_flushes = cache_flushes.load(std::memory_order_relaxed);
+    stats.trimmed_bytes = trimmed_bytes.load(std::memory_order_relaxed);
+    stats.movable_span_bytes = movable_span_bytes.load(std::memory_order_relaxed);
+    stats.movable_live_bytes = movable_live_bytes.load(std::memory_order_relaxed);
+    stats.movable_moves = movable_moves.load(std::memory_order_relaxed);
+    stats.compacted_bytes = compacted_bytes.load(std::memory_order_relaxed);
+    stats.page_heap_spans = 0;
+    for (const NodeArena& arena : arenas) {
+        stats.page_heap_spans += arena.page_heap.span_count.load(std::memory_order_relaxed);
+    }
+
+    size_t central_blocks[8] = {};
+    for (int node = 0; node < numaNodeCount(); ++node) {
+        for (size_t i = 0; i < 8; ++i) {
+            for (const TransferCache* tc : {&arenas[node].transfer_caches[i], &arenas[node].long_lived[i]}) {
+                std::lock_guard<ProfiledMutex> lock(tc->mtx);
+                central_blocks[i] += tc->count;
+            }
+        }
+    }
+
+    stats.page_heap_lock = stats.large_cache_lock = LockStats{};
+    for (size_t i = 0; i < 8; ++i) stats.transfer_cache_locks[i] = LockStats{};
+    for (int node = 0; node < numaNodeCount(); ++node) {
+        const NodeArena& arena = arenas[node];
+        for (size_t i = 0; i < 8; ++i) {
+            arena.transfer_caches[i].mtx.addTo(stats.transfer_cache_locks[i]);
+            arena.long_lived[i].mtx.addTo(stats.transfer_cache_locks[i]);
+        }
+        arena.page_heap.mtx.addTo(stats.page_heap_lock);
+        arena.large_cache.mtx.addTo(stats.large_cache_lock);
+    }
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    for (size_t i = 0; i < 8; ++i) {
+        stats.classes[i] = retired_stats[i];
+        stats.classes[i].central_blocks = central_blocks[i];
+        stats.classes[i].blocks_released = released_blocks[i].load(std::memory_order_relaxed);
+    }
+    for (ThreadCounters* counters = thread_registry; counters; counters = counters->next_thread) {
+        for (size_t i = 0; i < 8; ++i) {
+            stats.classes[i].fast_path_hits += counters->fast_path_hits[i].load(std::memory_order_relaxed);
+            stats.classes[i].transfer_fetches += counters->transfer_fetches[i].load(std::memory_order_relaxed);
+            stats.classes[i].page_heap_refills += counters->page_heap_refills[i].load(std::memory_order_relaxed);
+            stats.classes[i].blocks_carved += counters->blocks_carved[i].load(std::memory_order_relaxed);
+            stats.classes[i].scavenges += counters->scavenges[i].load(std::memory_order_relaxed);
+        }
+    }
+    return stats;
+}
+
+// --- Metrics Export ---
+// Appends to a caller-supplied buffer with snprintf, counting what did not
+// fit, so a scrape never allocates (and never recurses into the allocator).
+namespace {
+struct MetricsWriter {
+    char* buffer;
+    size_t capacity;
+    size_t length = 0;
+
+    void append(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        va_list args;
+        va_start(args, format);
+        size_t room = length < capacity ? capacity - length : 0;
+        int n = vsnprintf(room ? buffer + length : nullptr, room, format, args);
+        va_end(args);
+        if (n > 0) length += n;
+    }
+    void family(const char* name, const char* type, const char* unit, const char* help) {
+        append("# TYPE %s %s\n", name, type);
+        if (unit) append("# UNIT %s %s\n", name, unit);
+        append("# HELP %s %s\n", name, help);
+    }
+    void gauge(const char* name, const char* unit, const char* help, uint64_t value) {
+        family(name, "gauge", unit, help);
+        append("%s %llu\n", name, (unsigned long long)value);
+    }
+    void counter(const char* name, const char* unit, const char* help, uint64_t value) {
+        family(name, "counter", unit, help);
+        append("%s_total %llu\n", name, (unsigned long long)value);
+    }
+};
+} // namespace
+
+size_t MyAllocator::renderMetrics(char* buffer, size_t capacity) const {
+    Stats stats = getStats();
+    MetricsWriter out{buffer, capacity};
+
+    // Small blocks outside the transfer caches, and mapped bytes in no cache,
+    // are handed out or held by a thread cache.
+    // The counters are read one at a time, so a racing refill can make a
+    // difference briefly negative; those read as zero.
+    int64_t small_in_use = 0;
     for (size_t i = 0; i < 8; ++i) {
-        if (size <= SIZE_CLASSES[i]) return i;
+        const ClassStats& c = stats.classes[i];
+        int64_t blocks = (int64_t)(c.blocks_carved - c.blocks_released) - (int64_t)c.central_blocks;
+        small_in_use += std::max<int64_t>(blocks, 0) * SIZE_CLASSES[i];
+    }
+    int64_t large_in_use = (int64_t)stats.mapped_bytes - (int64_t)stats.small_span_bytes -
+                           (int64_t)stats.large_cache_bytes - (int64_t)stats.frame_span_bytes -
+                           (int64_t)stats.movable_span_bytes;
+
+    out.gauge("myalloc_mapped_bytes", "bytes", "Bytes currently mapped from the OS.", stats.mapped_bytes);
+    out.gauge("myalloc_in_use_bytes", "bytes",
+              "Bytes in small blocks, movable objects and large spans that are allocated or held by thread caches.",
+              (uint64_t)(small_in_use + stats.movable_live_bytes + std::max<int64_t>(large_in_use, 0)));
+    out.gauge("myalloc_small_span_bytes", "bytes", "Bytes in spans carved into small blocks.",
+              stats.small_span_bytes);
+    out.gauge("myalloc_large_cache_bytes", "bytes", "Freed large spans held in the central caches.",
+              stats.large_cache_bytes);
+    out.gauge("myalloc_frame_span_bytes", "bytes", "Bytes in spans carved into coroutine frame slots.",
+              stats.frame_span_bytes);
+    out.gauge("myalloc_page_heap_spans", nullptr, "Spans currently mapped by the page heaps.",
+              stats.page_heap_spans);
+    out.gauge("myalloc_movable_span_bytes", "bytes", "Bytes in spans carved into movable object slots.",
+              stats.movable_span_bytes);
+    out.counter("myalloc_trimmed_bytes", "bytes", "Bytes returned to the OS by trim().", stats.trimmed_bytes);
+    out.counter("myalloc_compacted_bytes", "bytes", "Bytes returned to the OS by compact().",
+                stats.compacted_bytes);
+    out.counter("myalloc_movable_moves", nullptr, "Movable objects relocated by compact().", stats.movable_moves);
+    out.counter("myalloc_cache_flushes", nullptr, "Whole thread caches handed back to the central tiers.",
+                stats.cache_flushes);
+    out.counter("myalloc_cross_node_frees", nullptr, "Small blocks freed by a thread on another NUMA node.",
+                stats.cross_node_frees);
+    out.counter("myalloc_soft_limit_events", nullptr, "Upward crossings of the soft memory limit.",
+                stats.soft_limit_events);
+    out.counter("myalloc_hard_limit_failures", nullptr, "Allocations refused at the hard memory limit.",
+                stats.hard_limit_failures);
+
+    // --- Per Size Class ---
+    struct ClassMetric {
+        const char* name;
+        const char* type;
+        const char* help;
+        uint64_t ClassStats::*field;
+    };
+    static const ClassMetric class_metrics[] = {
+        {"myalloc_central_blocks", "gauge", "Free blocks held by the transfer caches.", &ClassStats::central_blocks},
+        {"myalloc_fast_path_hits", "counter", "Allocations served straight from a thread cache.",
+         &ClassStats::fast_path_hits},
+        {"myalloc_transfer_fetches", "counter", "Thread cache refills from the transfer cache.",
+         &ClassStats::transfer_fetches},
+        {"myalloc_page_heap_refills", "counter", "Spans mapped for the class.", &ClassStats::page_heap_refills},
+        {"myalloc_scavenges", "counter", "Oversized thread cache lists handed back to the transfer cache.",
+         &ClassStats::scavenges},
+        {"myalloc_blocks_carved", "counter", "Blocks cut from fresh spans.", &ClassStats::blocks_carved},
+        {"myalloc_blocks_released", "counter", "Blocks of spans unmapped by trim().", &ClassStats::blocks_released},
+    };
+    for (const ClassMetric& metric : class_metrics) {
+        bool counter = metric.type[0] == 'c';
+        out.family(metric.name, metric.type, nullptr, metric.help);
+        for (size_t i = 0; i < 8; ++i) {
+            out.append("%s%s{class=\"%zu\"} %llu\n", metric.name, counter ? "_total" : "", SIZE_CLASSES[i],
+                       (unsigned long long)(stats.classes[i].*metric.field));
+        }
+    }
+
+    // --- Lock Profile ---
+    // Sampled, so these count one acquisition in LOCK_SAMPLE_INTERVAL.
+    struct LockMetric {
+        const char* name;
+        const char* help;
+        uint64_t LockStats::*field;
+    };
+    static const LockMetric lock_metrics[] = {
+        {"myalloc_lock_samples", "Sampled lock acquisitions.", &LockStats::samples},
+        {"myalloc_lock_contended", "Sampled acquisitions that found the lock taken.", &LockStats::contended},
+        {"myalloc_lock_wait_cycles", "rdtsc cycles spent waiting, over sampled acquisitions.",
+         &LockStats::wait_cycles},
+    };
+    for (const LockMetric& metric : lock_metrics) {
+        out.family(metric.name, "counter", nullptr, metric.help);
+        for (size_t i = 0; i < 8; ++i) {
+            out.append("%s_total{lock=\"transfer_cache\",class=\"%zu\"} %llu\n", metric.name, SIZE_CLASSES[i],
+                       (unsigned long long)(stats.transfer_cache_locks[i].*metric.field));
+        }
+        out.append("%s_total{lock=\"page_heap\"} %llu\n", metric.name,
+                   (unsigned long long)(stats.page_heap_lock.*metric.field));
+        out.append("%s_total{lock=\"large_cache\"} %llu\n", metric.name,
+                   (unsigned long long)(stats.large_cache_lock.*metric.field));
+    }
+    out.append("# EOF\n");
+    return out.length;
+}
+
+// --- Allocation Tracing ---
+#ifdef MYALLOC_TRACING
+static std::atomic<uint16_t> next_trace_thread{0};
+constexpr size_t TRACE_BUFFER_RECORDS = 4096; // 96 KB per thread
+
+// Per-thread record buffer, mapped on first use and appended to the trace
+// file in one write() when full or when the thread exits. O_APPEND keeps
+// chunks from different threads from interleaving.
+struct TraceBuffer {
+    MyAllocator::TraceRecord* records = nullptr;
+    size_t count = 0;
+    uint16_t thread = 0;
+
+    void flush() {
+        int fd = trace_fd.load(std::memory_order_acquire);
+        if (fd >= 0 && count > 0) {
+            ssize_t ignored = write(fd, records, count * sizeof(MyAllocator::TraceRecord));
+            (void)ignored;
+        }
+        count = 0;
+    }
+
+    ~TraceBuffer() {
+        flush();
+        if (records) munmap(records, TRACE_BUFFER_RECORDS * sizeof(MyAllocator::TraceRecord));
+    }
+};
+static thread_local TraceBuffer trace_buffer;
+
+void MyAllocator::traceEvent(TraceOp op, size_t size, void* ptr) {
+    if (ptr == nullptr || trace_fd.load(std::memory_order_relaxed) < 0) return;
+
+    TraceBuffer& buffer = trace_buffer;
+    if (buffer.records == nullptr) {
+        void* mem = mmap(nullptr, TRACE_BUFFER_RECORDS * sizeof(TraceRecord), PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED) return;
+        buffer.records = (TraceRecord*)mem;
+        buffer.thread = next_trace_thread.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    TraceRecord& record = buffer.records[buffer.count++];
+    record.timestamp_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+    record.ptr_id = (uintptr_t)ptr;
+    record.size = size > UINT32_MAX ? UINT32_MAX : (uint32_t)size;
+    record.thread = buffer.thread;
+    record.op = op;
+    record.reserved = 0;
+
+    if (buffer.count == TRACE_BUFFER_RECORDS) buffer.flush();
+}
+#endif
+
+bool MyAllocator::startTrace(const char* path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    if (write(fd, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != (ssize_t)sizeof(TRACE_MAGIC)) {
+        close(fd);
+        return false;
+    }
+    int previous = trace_fd.exchange(fd, std::memory_order_acq_rel);
+    if (previous >= 0) close(previous);
+    return true;
+}
+
+static void stopTraceInChild() {
+#ifdef MYALLOC_TRACING
+    trace_buffer.count = 0;
+#endif
+    int fd = trace_fd.exchange(-1, std::memory_order_relaxed);
+    if (fd >= 0) close(fd);
+}
+
+// Flushes the calling thread's records and closes the file. Threads still
+// running keep buffering but their records are dropped.
+void MyAllocator::stopTrace() {
+#ifdef MYALLOC_TRACING
+    trace_buffer.flush();
+#endif
+    int fd = trace_fd.exchange(-1, std::memory_order_acq_rel);
+    if (fd >= 0) close(fd);
+}
+
+// --- Tunables ---
+// Parses a byte count with an optional K/M/G suffix; returns false if the
+// string is not a number. strtoull does not allocate.
+static bool parseSize(const char* text, size_t* out) {
+    char* end = nullptr;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text) return false;
+    switch (*end) {
+        case 'k': case 'K': value <<= 10; ++end; break;
+        case 'm': case 'M': value <<= 20; ++end; break;
+        case 'g': case 'G': value <<= 30; ++end; break;
+        default: break;
+    }
+    if (*end != '\0') return false;
+    *out = (size_t)value;
+    return true;
+}
+
+// Reads MYALLOC_* overrides. Malformed or out-of-range values are ignored
+// and the compiled-in default stays in effect.
+void MyAllocator::loadTunablesFromEnv() {
+    static const struct {
+        const char* name;
+        Tunable tunable;
+    } env_tunables[] = {
+        {"MYALLOC_SCAVENGE_THRESHOLD", Tunable::ScavengeThreshold},
+        {"MYALLOC_TRANSFER_BATCH", Tunable::TransferBatch},
+        {"MYALLOC_REFILL_PAGES", Tunable::RefillPages},
+        {"MYALLOC_SOFT_LIMIT", Tunable::SoftLimit},
+        {"MYALLOC_HARD_LIMIT", Tunable::HardLimit},
+        {"MYALLOC_LARGE_CACHE_BYTES", Tunable::LargeCacheBytes},
+        {"MYALLOC_LARGE_CACHE_DECAY_MS", Tunable::LargeCacheDecayMs},
+    };
+    for (const auto& entry : env_tunables) {
+        const char* text = getenv(entry.name);
+        size_t value = 0;
+        if (text != nullptr && parseSize(text, &value)) setTunable(entry.tunable, value);
+    }
+
+    const char* policy = getenv("MYALLOC_RELEASE_POLICY");
+    if (policy != nullptr) {
+        if (strcmp(policy, "all") == 0) setTunable(Tunable::ReleasePolicy, RELEASE_ALL);
+        else if (strcmp(policy, "batch") == 0) setTunable(Tunable::ReleasePolicy, RELEASE_BATCH);
+    }
+}
+
+bool MyAllocator::setTunable(Tunable tunable, size_t value) {
+    switch (tunable) {
+        case Tunable::ScavengeThreshold:
+            if (value < 1 || value > 65536) return false;
+            tunables.scavenge_threshold.store((int)value, std::memory_order_relaxed);
+            return true;
+        case Tunable::TransferBatch:
+            if (value < 1 || value > 4096) return false;
+            tunables.transfer_batch.store(value, std::memory_order_relaxed);
+            return true;
+        case Tunable::RefillPages:
+            if (value < 1 || value > 256) return false;
+            tunables.refill_pages.store(value, std::memory_order_relaxed);
+            return true;
+        case Tunable::ReleasePolicy:
+            if (value != RELEASE_ALL && value != RELEASE_BATCH) return false;
+            tunables.release_policy.store(value, std::memory_order_relaxed);
+            return true;
+        case Tunable::SoftLimit:
+            soft_limit.store(value, std::memory_order_relaxed);
+            return true;
+        case Tunable::HardLimit:
+            hard_limit.store(value, std::memory_order_relaxed);
+            return true;
+        case Tunable::LargeCacheBytes:
+            tunables.large_cache_bytes.store(value, std::memory_order_relaxed);
+            return true;
+        case Tunable::LargeCacheDecayMs:
+            if (value < 1 || value > 3600 * 1000) return false;
+            tunables.large_cache_decay_ms.store(value, std::memory_order_relaxed);
+            return true;
+    }
+    return false;
+}
+
+size_t MyAllocator::getTunable(Tunable tunable) const {
+    switch (tunable) {
+        case Tunable::ScavengeThreshold: return tunables.scavenge_threshold.load(std::memory_order_relaxed);
+        case Tunable::TransferBatch: return tunables.transfer_batch.load(std::memory_order_relaxed);
+        case Tunable::RefillPages: return tunables.refill_pages.load(std::memory_order_relaxed);
+        case Tunable::ReleasePolicy: return tunables.release_policy.load(std::memory_order_relaxed);
+        case Tunable::SoftLimit: return soft_limit.load(std::memory_order_relaxed);
+        case Tunable::HardLimit: return hard_limit.load(std::memory_order_relaxed);
+        case Tunable::LargeCacheBytes: return tunables.large_cache_bytes.load(std::memory_order_relaxed);
+        case Tunable::LargeCacheDecayMs: return tunables.large_cache_decay_ms.load(std::memory_order_relaxed);
+    }
+    return 0;
+}
+
+// Span size for a transfer cache refill: the class's layout, or more if the
+// RefillPages tunable asks for larger spans.
+size_t MyAllocator::refillPages(size_t class_index) const {
+    size_t pages = tunables.refill_pages.load(std::memory_order_relaxed);
+    return pages > SPAN_LAYOUT.pages[class_index] ? pages : SPAN_LAYOUT.pages[class_index];
+}
+
+// Blocks moved between a thread cache and the transfer cache at a time:
+// the TransferBatch tunable, capped at one layout span of the class.
+size_t MyAllocator::transferBatch(size_t class_index) const {
+    size_t batch = tunables.transfer_batch.load(std::memory_order_relaxed);
+    return batch < SPAN_LAYOUT.objects[class_index] ? batch : SPAN_LAYOUT.objects[class_index];
+}
+
+// Returns part of an overlong thread cache list according to the release
+// policy: everything, or just one transfer batch from the hot end.
+void MyAllocator::scavenge(size_t class_index) {
+    checkFlushRequest(class_index);
+    countEvent(my_cache.counters.scavenges[class_index]);
+    int count = INT_MAX;
+    if (tunables.release_policy.load(std::memory_order_relaxed) == RELEASE_BATCH) {
+        count = (int)transferBatch(class_index);
+    }
+    releaseToTransferCache(class_index, count);
+}
+
+// Millisecond clock for the rate limits below; a few ms of slack is fine.
+static uint64_t coarseNowMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// --- Heap Budget ---
+void MyAllocator::setMemoryLimits(size_t soft, size_t hard) {
+    soft_limit.store(soft, std::memory_order_relaxed);
+    hard_limit.store(hard, std::memory_order_relaxed);
+}
+
+void MyAllocator::setMemoryCallback(MemoryCallback callback, void* arg) {
+    memory_callback_arg.store(arg, std::memory_order_relaxed);
+    memory_callback.store(callback, std::memory_order_release);
+}
+
+// Accounts for bytes about to be mapped. May run under allocator locks, so
+// it only records events in the thread cache; handleBudgetEvents acts on
+// them once the locks are dropped.
+bool MyAllocator::reserveBytes(size_t bytes) {
+    size_t now = mapped_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t hard = hard_limit.load(std::memory_order_relaxed);
+    if (hard != 0 && now > hard) {
+        mapped_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+        my_cache.budget_events |= BUDGET_HARD;
+        return false;
+    }
+    size_t soft = soft_limit.load(std::memory_order_relaxed);
+    if (soft != 0 && now > soft) {
+        my_cache.budget_events |= BUDGET_SOFT;
+    }
+    return true;
+}
+
+void MyAllocator::unreserveBytes(size_t bytes) {
+    size_t now = mapped_bytes.fetch_sub(bytes, std::memory_order_relaxed) - bytes;
+    size_t soft = soft_limit.load(std::memory_order_relaxed);
+    if (soft == 0 || now <= soft) {
+        over_soft_limit.store(false, std::memory_order_relaxed);
+    }
+}
+
+// Called without locks after an allocation attempt. Returns true if the
+// caller should retry an allocation that was refused at the hard limit.
+// keep_class names a list the caller just refilled, which is not flushed.
+bool MyAllocator::handleBudgetEvents(size_t requested_bytes, size_t keep_class) {
+    unsigned events = my_cache.budget_events;
+    if (events == 0) return false;
+    my_cache.budget_events = 0;
+
+    MemoryCallback callback = memory_callback.load(std::memory_order_acquire);
+    void* arg = memory_callback_arg.load(std::memory_order_relaxed);
+
+    if (events & BUDGET_SOFT) {
+        // Every mapping above the limit raises the event, but a release
+        // rescans every cache on every node, so only the crossing itself and
+        // then one mapping per SOFT_LIMIT_RELEASE_MS pay for it.
+        bool crossed = !over_soft_limit.exchange(true, std::memory_order_relaxed);
+        uint64_t now = coarseNowMs();
+        uint64_t last = soft_release_ms.load(std::memory_order_relaxed);
+        bool release = crossed;
+        if (crossed) {
+            soft_release_ms.store(now, std::memory_order_relaxed);
+        } else if (now >= last + SOFT_LIMIT_RELEASE_MS) {
+            release = soft_release_ms.compare_exchange_strong(last, now, std::memory_order_relaxed);
+        }
+        if (release) {
+            // Hand the flushed blocks' spans back to the OS too, so the soft
+            // limit shrinks the heap rather than just moving memory around.
+            flushThreadCache(keep_class);
+            releaseCachedSpans(0);
+        }
+        if (crossed) {
+            soft_limit_events.fetch_add(1, std::memory_order_relaxed);
+            if (callback) callback(MemoryEvent::SoftLimit, requested_bytes, arg);
+        }
+    }
+
+    if (events & BUDGET_HARD) {
+        flushThreadCache(keep_class);
+        // Cached and entirely free spans still count against the budget;
+        // unmapping them may make room without bothering the callback.
+        if (releaseCachedSpans(0) != 0) return true;
+        if (callback && callback(MemoryEvent::HardLimit, requested_bytes, arg)) return true;
+        hard_limit_failures.fetch_add(1, std::memory_order_relaxed);
+    }
+    return false;
+}
+
+// Returns every list and unused bump region in this thread's cache to the
+// transfer caches, and its large spans to the central cache, so other
+// threads can reuse them before anyone maps more memory.
+void MyAllocator::flushThreadCache(size_t keep_class) {
+    cache_flushes.fetch_add(1, std::memory_order_relaxed);
+    for (size_t index = 0; index < 8; ++index) {
+        if (index == keep_class) continue;
+        releaseToTransferCache(index);
+        releaseBumpRegion(index);
+    }
+    for (size_t i = 0; i < my_cache.large_count; ++i) pushCentralSpan(my_cache.large_spans[i]);
+    my_cache.large_count = 0;
+    my_cache.large_bytes = 0;
+    for (size_t frame_class = 0; frame_class < FRAME_CLASSES; ++frame_class) {
+        releaseFrameStack(frame_class, 0);
+    }
+    releaseFrameBump();
+}
+
+// Honours a trim() issued since this thread last looked.
+inline void MyAllocator::checkFlushRequest(size_t keep_class) {
+    unsigned requested = flush_requests.load(std::memory_order_relaxed);
+    if (__builtin_expect(my_cache.flush_epoch != requested, 0)) {
+        my_cache.flush_epoch = requested;
+        flushThreadCache(keep_class);
+    }
+}
+
+// --- Large Object Cache ---
+// Freed spans of up to LARGE_CACHE_MAX_PAGES stay mapped and are handed to
+// the next large allocation of the same bucket instead of going through
+// munmap/mmap. A thread keeps its last few frees privately; older ones go to
+// its node's central cache, which is capped at the LargeCacheBytes tunable.
+// Spans older than LargeCacheDecayMs are unmapped on later frees, so an idle
+// cache shrinks once the program frees large blocks again. Cached bytes stay
+// counted in mapped_bytes.
+size_t MyAllocator::largeBucketIndex(size_t num_pages) {
+    if (num_pages > LARGE_CACHE_MAX_PAGES) return LARGE_BUCKETS;
+    if (num_pages <= 8) return num_pages - 1;
+    int log = 63 - __builtin_clzl(num_pages - 1); // 3..7
+    int shift = log - 2;
+    size_t steps = (num_pages + (1UL << shift) - 1) >> shift; // 5..8
+    return 8 + (log - 3) * 4 + (steps - 5);
+}
+
+size_t MyAllocator::largeBucketPages(size_t bucket) {
+    if (bucket < 8) return bucket + 1;
+    size_t log = 3 + (bucket - 8) / 4;
+    size_t steps = 5 + (bucket - 8) % 4;
+    return steps << (log - 2);
+}
+
+// Returns a cached span of exactly num_pages on the given node, or nullptr.
+MyAllocator::Span* MyAllocator::takeCachedSpan(size_t num_pages, int node) {
+    Span* span = nullptr;
+    for (size_t i = my_cache.large_count; i-- > 0;) {
+        Span* candidate = my_cache.large_spans[i];
+        if (candidate->num_pages == num_pages && candidate->node == node) {
+            span = candidate;
+            for (size_t j = i + 1; j < my_cache.large_count; ++j) {
+                my_cache.large_spans[j - 1] = my_cache.large_spans[j];
+            }
+            my_cache.large_count--;
+            my_cache.large_bytes -= num_pages << PAGE_SHIFT;
+            break;
+        }
+    }
+
+    if (span == nullptr) {
+        LargeCache& cache = arenas[node].large_cache;
+        size_t bucket = largeBucketIndex(num_pages);
+        std::lock_guard<ProfiledMutex> lock(cache.mtx);
+        span = cache.heads[bucket];
+        if (span == nullptr) return nullptr;
+        cache.heads[bucket] = span->next;
+        if (span->next) span->next->prev = nullptr;
+        else cache.tails[bucket] = nullptr;
+        cache.bytes.store(cache.bytes.load(std::memory_order_relaxed) - (span->num_pages << PAGE_SHIFT),
+                          std::memory_order_relaxed);
+    }
+
+    span->next = nullptr;
+    span->prev = nullptr;
+    span->is_free = false;
+    span->zeroed = false;
+    return span;
+}
+
+// Keeps a freed large span for reuse. Returns false if it must be unmapped.
+bool MyAllocator::cacheLargeSpan(Span* span) {
+    // Only bucket-sized spans, so every span in a bucket fits every request
+    // mapped to it; spans allocated while the cache was off may be smaller.
+    size_t bucket = largeBucketIndex(span->num_pages);
+    if (bucket >= LARGE_BUCKETS || largeBucketPages(bucket) != span->num_pages) return false;
+    if (tunables.large_cache_bytes.load(std::memory_order_relaxed) == 0) return false;
+
+    span->is_free = true;
+    span->cached_ms = coarseNowMs();
+    size_t span_bytes = span->num_pages << PAGE_SHIFT;
+    if (span->node != currentNode() || span_bytes > LARGE_THREAD_CACHE_BYTES) {
+        pushCentralSpan(span);
+        return true;
+    }
+
+    // Make room in the thread's slots by passing its oldest spans on.
+    while (my_cache.large_count == LARGE_THREAD_SLOTS ||
+           my_cache.large_bytes + span_bytes > LARGE_THREAD_CACHE_BYTES) {
+        Span* oldest = my_cache.large_spans[0];
+        for (size_t j = 1; j < my_cache.large_count; ++j) {
+            my_cache.large_spans[j - 1] = my_cache.large_spans[j];
+        }
+        my_cache.large_count--;
+        my_cache.large_bytes -= oldest->num_pages << PAGE_SHIFT;
+        pushCentralSpan(oldest);
+    }
+    my_cache.large_spans[my_cache.large_count++] = span;
+    my_cache.large_bytes += span_bytes;
+    return true;
+}
+
+void MyAllocator::pushCentralSpan(Span* span) {
+    NodeArena& arena = arenas[span->node];
+    LargeCache& cache = arena.large_cache;
+    size_t bucket = largeBucketIndex(span->num_pages);
+    size_t cap = tunables.large_cache_bytes.load(std::memory_order_relaxed);
+    uint64_t decay_ms = tunables.large_cache_decay_ms.load(std::memory_order_relaxed);
+    uint64_t now = span->cached_ms;
+    bool trim;
+    {
+        std::lock_guard<ProfiledMutex> lock(cache.mtx);
+        span->prev = nullptr;
+        span->next = cache.heads[bucket];
+        if (span->next) span->next->prev = span;
+        else cache.tails[bucket] = span;
+        cache.heads[bucket] = span;
+        size_t bytes = cache.bytes.load(std::memory_order_relaxed) + (span->num_pages << PAGE_SHIFT);
+        cache.bytes.store(bytes, std::memory_order_relaxed);
+
+        // Age out old spans a few times per decay interval, not on every free.
+        trim = bytes > cap || now >= cache.last_trim_ms + decay_ms / 4;
+        if (trim) cache.last_trim_ms = now;
+    }
+    if (trim) trimLargeCache(arena, cap, now > decay_ms ? now - decay_ms : 0);
+}
+
+// Unmaps cached spans, oldest first, until the central cache holds at most
+// keep_bytes and nothing cached before expire_before_ms. Returns the bytes
+// released. The unmapping happens after cache.mtx is dropped.
+size_t MyAllocator::trimLargeCache(NodeArena& arena, size_t keep_bytes, uint64_t expire_before_ms) {
+    LargeCache& cache = arena.large_cache;
+    Span* victims = nullptr;
+    {
+        std::lock_guard<ProfiledMutex> lock(cache.mtx);
+        size_t bytes = cache.bytes.load(std::memory_order_relaxed);
+        while (true) {
+            size_t oldest_bucket = LARGE_BUCKETS;
+            for (size_t bucket = 0; bucket < LARGE_BUCKETS; ++bucket) {
+                Span* tail = cache.tails[bucket];
+                if (tail && (oldest_bucket == LARGE_BUCKETS ||
+                             tail->cached_ms < cache.tails[oldest_bucket]->cached_ms)) {
+                    oldest_bucket = bucket;
+                }
+            }
+            if (oldest_bucket == LARGE_BUCKETS) break;
+            Span* span = cache.tails[oldest_bucket];
+            if (bytes <= keep_bytes && span->cached_ms >= expire_before_ms) break;
+
+            cache.tails[oldest_bucket] = span->prev;
+            if (span->prev) span->prev->next = nullptr;
+            else cache.heads[oldest_bucket] = nullptr;
+            bytes -= span->num_pages << PAGE_SHIFT;
+            span->next = victims;
+            victims = span;
+        }
+        cache.bytes.store(bytes, std::memory_order_relaxed);
+    }
+
+    size_t released = 0;
+    while (victims) {
+        Span* span = victims;
+        victims = span->next;
+        size_t span_bytes = span->num_pages << PAGE_SHIFT;
+        arena.page_heap.deallocateSpan(span);
+        unreserveBytes(span_bytes);
+        released += span_bytes;
     }
-    return 8; // Return invalid index, not -1
+    return released;
 }
 
-size_t MyAllocator::getClassSizeFromIndex(size_t index) {
-    if (index >= 8) return 0; // Safety check
-    return SIZE_CLASSES[index];
+// --- Heap Trimming ---
+size_t MyAllocator::trim(size_t keep_bytes) {
+    my_cache.flush_epoch = flush_requests.fetch_add(1, std::memory_order_relaxed) + 1;
+    flushThreadCache();
+    size_t released = releaseCachedSpans(keep_bytes);
+    trimmed_bytes.fetch_add(released, std::memory_order_relaxed);
+    return released;
+}
+
+// Unmaps the large span caches and every entirely free small or movable
+// span beyond keep_bytes. Takes the pool locks itself, so it must be called
+// without any allocator lock held.
+size_t MyAllocator::releaseCachedSpans(size_t keep_bytes) {
+    // Large spans first: the caches are already grouped by span, and a
+    // cached large span is worth less than a nearly-full small one.
+    size_t released = 0;
+    for (int node = 0; node < numaNodeCount(); ++node) {
+        released += trimLargeCache(arenas[node], keep_bytes, 0);
+        keep_bytes -= std::min(keep_bytes, arenas[node].large_cache.bytes.load(std::memory_order_relaxed));
+    }
+    for (int node = 0; node < numaNodeCount(); ++node) {
+        NodeArena& arena = arenas[node];
+        for (size_t index = 0; index < 8; ++index) {
+            released += releaseFreeSpans(arena, arena.transfer_caches[index], index, keep_bytes);
+            released += releaseFreeSpans(arena, arena.long_lived[index], index, keep_bytes);
+        }
+    }
+    for (size_t index = 0; index < 8; ++index) released += releaseEmptyMovableSpans(index, keep_bytes);
+    return released;
+}
+
+// Unmaps the spans of one transfer cache (or long-lived pool) whose blocks
+// are all in it. Blocks always go back to their home node and pool, so a
+// span is entirely free exactly when the cache holds all of its blocks. One
+// pass counts blocks per span, a second unlinks the blocks of free spans
+// beyond keep_bytes; the spans are unmapped after the lock is dropped, when
+// nothing can reach them. The page heap lock is held across both passes
+// rather than taken per block, and consecutive blocks, which usually share a
+// span, skip the page map. The thread cache is shared by every instance, so
+// blocks of another MyAllocator can land here; they have no span in this
+// page heap and are left on the list.
+size_t MyAllocator::releaseFreeSpans(NodeArena& arena, TransferCache& tc, size_t class_index,
+                                     size_t& keep_bytes) {
+    size_t block_size = getClassSizeFromIndex(class_index) + sizeof(BlockHeader);
+    Span* victims = nullptr;
+    {
+        std::lock_guard<ProfiledMutex> lock(tc.mtx);
+        std::lock_guard<ProfiledMutex> page_lock(arena.page_heap.mtx);
+        Span* last = nullptr;
+        auto spanOf = [&](FreeBlockHeader* block) {
+            size_t page_id = (uintptr_t)block >> PAGE_SHIFT;
+            if (last == nullptr || page_id - last->start_page_id >= last->num_pages) {
+                last = arena.page_heap.lookupSpanLocked(block);
+            }
+            return last;
+        };
+        for (FreeBlockHeader* block = tc.list; block; block = nextOf(block)) {
+            Span* span = spanOf(block);
+            if (span) ++span->free_blocks;
+        }
+
+        FreeBlockHeader* head = nullptr;
+        FreeBlockHeader* tail = nullptr;
+        int count = 0;
+        for (FreeBlockHeader* block = tc.list, *next; block; block = next) {
+            next = nextOf(block);
+            Span* span = spanOf(block);
+            size_t span_bytes = span ? span->num_pages << PAGE_SHIFT : 0;
+            if (span && span->free_blocks == span_bytes / block_size) {
+                // First block seen of an entirely free span: keep or release it.
+                if (keep_bytes >= span_bytes) {
+                    keep_bytes -= span_bytes;
+                    span->free_blocks = 0;
+                } else {
+                    span->free_blocks = SIZE_MAX;
+                    span->next = victims;
+                    victims = span;
+                }
+            }
+            if (span) {
+                if (span->free_blocks == SIZE_MAX) continue;
+                span->free_blocks = 0;
+            }
+            if (tail) setNext(tail, block);
+            else head = block;
+            tail = block;
+            ++count;
+        }
+        if (tail) setNext(tail, nullptr);
+        tc.list = head;
+        tc.count = count;
+    }
+
+    size_t released = 0;
+    while (victims) {
+        Span* span = victims;
+        victims = span->next;
+        size_t span_bytes = span->num_pages << PAGE_SHIFT;
+        arena.page_heap.deallocateSpan(span);
+        unreserveBytes(span_bytes);
+        small_span_bytes.fetch_sub(span_bytes, std::memory_order_relaxed);
+        released_blocks[class_index].fetch_add(span_bytes / block_size, std::memory_order_relaxed);
+        released += span_bytes;
+    }
+    return released;
 }
 
 // --- PageHeap Implementation ---
 MyAllocator::Span* MyAllocator::PageHeap::lookupSpan(void* ptr) {
-    size_t page_id = (uintptr_t)ptr >> PAGE_SHIFT;
-    std::lock_guard<std::mutex> lock(mtx);
-    auto it = page_map.find(page_id);
+    std::lock_guard<ProfiledMutex> lock(mtx);
+    return lookupSpanLocked(ptr);
+}
+
+MyAllocator::Span* MyAllocator::PageHeap::lookupSpanLocked(void* ptr) {
+    auto it = page_map.find((uintptr_t)ptr >> PAGE_SHIFT);
     return (it == page_map.end()) ? nullptr : it->second;
 }
 
-MyAllocator::Span* MyAllocator::PageHeap::allocateSpan(size_t num_pages) {
-    std::lock_guard<std::mutex> lock(mtx);
+MyAllocator::Span* MyAllocator::PageHeap::allocateSpan(size_t num_pages, int node) {
+    std::lock_guard<ProfiledMutex> lock(mtx);
     size_t total_size = num_pages << PAGE_SHIFT;
     void* new_mem = mmap(nullptr, total_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     if (new_mem == MAP_FAILED) {
         return nullptr;
     }
 
+    // Prefer the arena's node before the first touch places the pages.
+    if (numaNodeCount() > 1) {
+        unsigned long node_mask = 1UL << node;
+        syscall(SYS_mbind, new_mem, total_size, MPOL_PREFERRED, &node_mask, sizeof(node_mask) * 8, 0);
+    }
+
     // Use pre-allocated memory instead of malloc to avoid recursion
     Span* span = (Span*)allocate_span_memory(sizeof(Span));
     if (!span) {
@@ -68,145 +1141,923 @@ MyAllocator::Span* MyAllocator::PageHeap::allocateSpan(size_t num_pages) {
     span->start_page_id = (uintptr_t)new_mem >> PAGE_SHIFT;
     span->num_pages = num_pages;
     span->is_free = false;
+    span->zeroed = true;
+    span->size_class = -1;
+    span->node = node;
+    span->free_blocks = 0;
+    span->long_lived = false;
+    span->movable = false;
+    span->live_slots = 0;
+    span->free_slots = nullptr;
     span->next = nullptr;
     span->prev = nullptr;
 
     for (size_t i = 0; i < num_pages; ++i) {
         page_map[span->start_page_id + i] = span;
     }
+    span_count.fetch_add(1, std::memory_order_relaxed);
     return span;
 }
 
 void MyAllocator::PageHeap::deallocateSpan(Span* span) {
-    std::lock_guard<std::mutex> lock(mtx);
+    std::lock_guard<ProfiledMutex> lock(mtx);
     munmap((void*)(span->start_page_id << PAGE_SHIFT), span->num_pages << PAGE_SHIFT);
     for (size_t i = 0; i < span->num_pages; ++i) {
         page_map.erase(span->start_page_id + i);
     }
-    // Don't free span memory since it's from our pre-allocated pool
+    span_count.fetch_sub(1, std::memory_order_relaxed);
+    // Recycle the record so the pre-allocated pool is not exhausted by churn
+    release_span_memory(span);
 }
 
 // --- Main Allocator Logic ---
-void MyAllocator::fetchFromTransferCache(size_t class_index) {
-    if (class_index >= 8) return;
-    
-    TransferCache& tc = transfer_caches[class_index];
-    std::lock_guard<std::mutex> lock(tc.mtx);
+// Maps a fresh span as this thread's bump region for the class. The blocks
+// are cut from it as they are allocated, so pages that are never used are
+// never touched.
+bool MyAllocator::refillBumpRegion(size_t class_index) {
+    int node = currentNode();
+    size_t num_pages = refillPages(class_index);
+    size_t span_bytes = num_pages << PAGE_SHIFT;
+
+    if (!reserveBytes(span_bytes)) return false;
+    Span* span = arenas[node].page_heap.allocateSpan(num_pages, node);
+    if (span == nullptr) {
+        unreserveBytes(span_bytes);
+        return false;
+    }
+    span->size_class = (int)class_index;
+    small_span_bytes.fetch_add(span_bytes, std::memory_order_relaxed);
+    countEvent(my_cache.counters.page_heap_refills[class_index]);
 
-    if (tc.count == 0) {
-        size_t block_size = getClassSizeFromIndex(class_index);
-        if (block_size == 0) return;
-        
-        // Use actual block size including header
-        size_t actual_block_size = block_size + sizeof(BlockHeader);
-        size_t num_blocks_to_fetch = 4096 / actual_block_size;
-        if (num_blocks_to_fetch == 0) num_blocks_to_fetch = 1;
+    size_t block_size = getClassSizeFromIndex(class_index) + sizeof(BlockHeader);
+    char* start = (char*)(span->start_page_id << PAGE_SHIFT);
+    my_cache.bump[class_index].next = start;
+    my_cache.bump[class_index].end = start + span_bytes / block_size * block_size;
+    return true;
+}
 
-        Span* span = page_heap.allocateSpan(1);
-        if (span == nullptr) return;
+// Threads whatever is left of this thread's bump region onto the transfer
+// cache, still tagged as zero-filled, so other threads can use it.
+void MyAllocator::releaseBumpRegion(size_t class_index) {
+    BumpRegion& bump = my_cache.bump[class_index];
+    if (bump.next == bump.end) return;
 
-        char* start = (char*)(span->start_page_id << PAGE_SHIFT);
-        
-        for(size_t i = 0; i < num_blocks_to_fetch; ++i) {
-            char* block_ptr = start + i * actual_block_size;
-            FreeBlockHeader* block = reinterpret_cast<FreeBlockHeader*>(block_ptr);
-            block->next = tc.list;
-            tc.list = block;
-        }
-        tc.count += num_blocks_to_fetch;
+    size_t block_size = getClassSizeFromIndex(class_index) + sizeof(BlockHeader);
+    size_t count = (bump.end - bump.next) / block_size;
+    FreeBlockHeader* tail = (FreeBlockHeader*)(bump.end - block_size);
+    FreeBlockHeader* head = (FreeBlockHeader*)bump.next;
+    SpanInit::threadBlocks(bump.next, count, block_size, 0, ZERO_TAG, linkKey());
+    bump.next = bump.end = nullptr;
+    countEvent(my_cache.counters.blocks_carved[class_index], count);
+
+    TransferCache& tc = arenas[currentNode()].transfer_caches[class_index];
+    std::lock_guard<ProfiledMutex> lock(tc.mtx);
+    setNext(tail, tc.list);
+    tc.list = head;
+    tc.count += count;
+}
+
+// Detaches up to count returned blocks from this node's transfer cache as a
+// single null-terminated segment. Fresh memory comes from bump regions.
+size_t MyAllocator::fetchRange(size_t class_index, size_t count, FreeBlockHeader** out_head) {
+    TransferCache& tc = arenas[currentNode()].transfer_caches[class_index];
+    countEvent(my_cache.counters.transfer_fetches[class_index]);
+    std::lock_guard<ProfiledMutex> lock(tc.mtx);
+
+    size_t fetched = std::min(count, (size_t)tc.count);
+    if (fetched == 0) {
+        *out_head = nullptr;
+        return 0;
     }
 
-    // Transfer some blocks to thread cache
-    int blocks_to_transfer = std::min((int)tc.count, 32);
-    
     FreeBlockHeader* head = tc.list;
     FreeBlockHeader* tail = head;
+    for (size_t i = 1; i < fetched; ++i) {
+        tail = nextOf(tail);
+    }
+    tc.list = nextOf(tail);
+    setNext(tail, nullptr);
+    tc.count -= fetched;
+
+    *out_head = head;
+    return fetched;
+}
+
+size_t MyAllocator::fetchFromTransferCache(size_t class_index) {
+    if (class_index >= 8) return 0;
+
+    // Transfer some blocks to thread cache
+    FreeBlockHeader* head = nullptr;
+    size_t fetched = fetchRange(class_index, transferBatch(class_index), &head);
+    if (fetched == 0) return 0;
+
+    my_cache.lists[class_index].head = head;
+    my_cache.lists[class_index].length = (int)fetched;
+    return fetched;
+}
+
+// Moves the first count blocks of this thread's list (all of them by
+// default) onto the transfer cache as one segment.
+void MyAllocator::releaseToTransferCache(size_t class_index, int count) {
+    if (class_index >= 8 || my_cache.lists[class_index].length == 0) return;
+    FreeList& list = my_cache.lists[class_index];
+    count = std::min(count, list.length);
     
-    for (int i = 1; i < blocks_to_transfer && tail && tail->next; ++i) {
-        tail = tail->next;
+    TransferCache& tc = arenas[currentNode()].transfer_caches[class_index];
+    std::lock_guard<ProfiledMutex> lock(tc.mtx);
+
+    // Find the tail of the segment being released
+    FreeBlockHeader* head = list.head;
+    FreeBlockHeader* tail = head;
+    for (int i = 1; i < count; ++i) {
+        tail = nextOf(tail);
     }
     
-    if (tail) {
-        tc.list = tail->next;
-        tail->next = nullptr;
-        tc.count -= blocks_to_transfer;
-        
-        my_cache.free_lists[class_index] = head;
-        my_cache.list_lengths[class_index] = blocks_to_transfer;
+    list.head = nextOf(tail);
+    list.length -= count;
+    setNext(tail, tc.list);  // Connect to existing transfer cache list
+    tc.list = head;
+    tc.count += count;
+}
+
+// Blocks freed away from their home node go straight back to that node's
+// transfer cache so thread caches only ever hold node-local memory.
+void MyAllocator::releaseRemoteBlock(FreeBlockHeader* block, size_t class_index, int node) {
+    cross_node_frees.fetch_add(1, std::memory_order_relaxed);
+
+    TransferCache& tc = arenas[node].transfer_caches[class_index];
+    std::lock_guard<ProfiledMutex> lock(tc.mtx);
+    pushBlock(block, tc.list);
+    tc.list = block;
+    tc.count++;
+}
+
+// --- Long-Lived Pools ---
+// Maps a span for the class and threads all of it onto the pool, tagged as
+// zero-filled. Caller holds pool.mtx.
+bool MyAllocator::refillLongLivedPool(TransferCache& pool, size_t class_index, int node) {
+    size_t num_pages = refillPages(class_index);
+    size_t span_bytes = num_pages << PAGE_SHIFT;
+    if (!reserveBytes(span_bytes)) return false;
+    Span* span = arenas[node].page_heap.allocateSpan(num_pages, node);
+    if (span == nullptr) {
+        unreserveBytes(span_bytes);
+        return false;
     }
+    span->size_class = (int)class_index;
+    span->long_lived = true;
+    small_span_bytes.fetch_add(span_bytes, std::memory_order_relaxed);
+
+    size_t block_size = getClassSizeFromIndex(class_index) + sizeof(BlockHeader);
+    size_t count = span_bytes / block_size;
+    char* start = (char*)(span->start_page_id << PAGE_SHIFT);
+    SpanInit::threadBlocks(start, count, block_size, (uintptr_t)pool.list, ZERO_TAG, linkKey());
+    pool.list = (FreeBlockHeader*)start;
+    pool.count += (int)count;
+    countEvent(my_cache.counters.page_heap_refills[class_index]);
+    countEvent(my_cache.counters.blocks_carved[class_index], count);
+    return true;
 }
 
-void MyAllocator::releaseToTransferCache(size_t class_index) {
-    if (class_index >= 8 || my_cache.list_lengths[class_index] == 0) return;
-    
-    TransferCache& tc = transfer_caches[class_index];
-    std::lock_guard<std::mutex> lock(tc.mtx);
+void* MyAllocator::allocate(size_t size, Lifetime lifetime) {
+    if (lifetime == Lifetime::Short || size - 1 >= MAX_SMALL_ALLOC_SIZE) return allocate(size);
+    void* ptr = allocateLongLived(getSizeClassIndex(size));
+#ifdef MYALLOC_TRACING
+    traceEvent(TRACE_ALLOC, size, ptr);
+#endif
+    return ptr;
+}
 
-    // Find the tail of the thread cache list
-    FreeBlockHeader* head = my_cache.free_lists[class_index];
+void* MyAllocator::allocateLongLived(size_t class_index) {
+    int node = currentNode();
+    TransferCache& pool = arenas[node].long_lived[class_index];
+    FreeBlockHeader* block = nullptr;
+    do {
+        std::lock_guard<ProfiledMutex> lock(pool.mtx);
+        if (pool.list != nullptr || refillLongLivedPool(pool, class_index, node)) {
+            block = pool.list;
+            pool.list = nextOf(block);
+            pool.count--;
+        }
+    } while (handleBudgetEvents(refillPages(class_index) << PAGE_SHIFT) && block == nullptr);
+    if (block == nullptr) return nullptr;
+    return initSmallBlock(block, getClassSizeFromIndex(class_index) | LONG_LIVED_FLAG, node);
+}
+
+// Long-lived blocks always go back to their home pool, never to a thread
+// cache, so their spans stay free of short-lived blocks.
+void MyAllocator::deallocateLongLived(BlockHeader* header) {
+    size_t class_index = getSizeClassIndex(header->size & ~LONG_LIVED_FLAG);
+    int node = header->node;
+    FreeBlockHeader* block = (FreeBlockHeader*)header;
+    TransferCache& pool = arenas[node].long_lived[class_index];
+    if (node != currentNode()) cross_node_frees.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<ProfiledMutex> lock(pool.mtx);
+    pushBlock(block, pool.list);
+    pool.list = block;
+    pool.count++;
+}
+
+// --- Coroutine Frames ---
+// Empty stack: take a batch from the central pool, else cut a slot from this
+// thread's frame span, mapping a new one when that is used up.
+void* MyAllocator::allocateFrameSlow(size_t frame_class) {
+    FrameStack& stack = my_cache.frames[frame_class];
+    FramePool& pool = frame_pools[frame_class];
+    {
+        std::lock_guard<ProfiledMutex> lock(pool.mtx);
+        if (pool.list != nullptr) {
+            FreeBlockHeader* tail = pool.list;
+            size_t count = 1;
+            for (; count < FRAME_STACK_LIMIT / 2 && nextOf(tail); ++count) tail = nextOf(tail);
+            FreeBlockHeader* slot = pool.list;
+            pool.list = nextOf(tail);
+            pool.count -= count;
+            setNext(tail, nullptr);
+            stack.head = nextOf(slot);
+            stack.depth = count - 1;
+            return slot;
+        }
+    }
+
+    size_t slot_size = (frame_class + 1) * FRAME_GRANULE;
+    BumpRegion& bump = my_cache.frame_bump;
+    if ((size_t)(bump.end - bump.next) < slot_size) {
+        int node = currentNode();
+        size_t span_bytes = FRAME_SPAN_PAGES << PAGE_SHIFT;
+        Span* span = nullptr;
+        do {
+            if (reserveBytes(span_bytes)) {
+                span = arenas[node].page_heap.allocateSpan(FRAME_SPAN_PAGES, node);
+                if (span == nullptr) unreserveBytes(span_bytes);
+            }
+        } while (handleBudgetEvents(span_bytes) && span == nullptr);
+        if (span == nullptr) return nullptr;
+        releaseFrameBump();
+        frame_span_bytes.fetch_add(span_bytes, std::memory_order_relaxed);
+        bump.next = (char*)(span->start_page_id << PAGE_SHIFT);
+        bump.end = bump.next + span_bytes;
+    }
+    void* slot = bump.next;
+    bump.next += slot_size;
+    return slot;
+}
+
+// Moves all but the newest keep slots of a frame stack to the central pool.
+void MyAllocator::releaseFrameStack(size_t frame_class, size_t keep) {
+    FrameStack& stack = my_cache.frames[frame_class];
+    if (stack.depth <= keep) return;
+    FreeBlockHeader* last_kept = nullptr;
+    FreeBlockHeader* head = stack.head;
+    for (size_t i = 0; i < keep; ++i) {
+        last_kept = head;
+        head = nextOf(head);
+    }
     FreeBlockHeader* tail = head;
-    int count = 1;
-    
-    // Safely traverse to find tail, with bounds checking
-    while (tail && tail->next && count < my_cache.list_lengths[class_index]) {
-        tail = tail->next;
-        count++;
+    while (nextOf(tail)) tail = nextOf(tail);
+    size_t count = stack.depth - keep;
+    if (last_kept) setNext(last_kept, nullptr);
+    else stack.head = nullptr;
+    stack.depth = keep;
+
+    FramePool& pool = frame_pools[frame_class];
+    std::lock_guard<ProfiledMutex> lock(pool.mtx);
+    setNext(tail, pool.list);
+    pool.list = head;
+    pool.count += count;
+}
+
+// Cuts what is left of this thread's frame span into the largest slots that
+// fit and hands them to the central pools, so a retiring span wastes less
+// than one granule.
+void MyAllocator::releaseFrameBump() {
+    BumpRegion& bump = my_cache.frame_bump;
+    while ((size_t)(bump.end - bump.next) >= FRAME_GRANULE) {
+        size_t slot_size = std::min<size_t>(bump.end - bump.next, MAX_FRAME_SIZE) / FRAME_GRANULE * FRAME_GRANULE;
+        FreeBlockHeader* slot = (FreeBlockHeader*)bump.next;
+        FramePool& pool = frame_pools[slot_size / FRAME_GRANULE - 1];
+        std::lock_guard<ProfiledMutex> lock(pool.mtx);
+        pushBlock(slot, pool.list);
+        pool.list = slot;
+        pool.count++;
+        bump.next += slot_size;
     }
-    
-    if (tail) {
-        tail->next = tc.list;  // Connect to existing transfer cache list
+    bump.next = bump.end = nullptr;
+}
+
+// --- Movable Objects ---
+// A pin that finds the object mid-move waits for the copy, which is at most
+// MAX_SMALL_ALLOC_SIZE bytes.
+void* MyAllocator::pinSlow(MovableEntry& entry) {
+    uint32_t pins = entry.pins.load(std::memory_order_relaxed);
+    while (true) {
+        if (pins & PIN_MOVING) {
+            sched_yield();
+            pins = entry.pins.load(std::memory_order_relaxed);
+        } else if (entry.pins.compare_exchange_weak(pins, pins + 1, std::memory_order_acquire,
+                                                    std::memory_order_relaxed)) {
+            return entry.ptr.load(std::memory_order_relaxed);
+        }
     }
-    
-    tc.list = head;
-    tc.count += my_cache.list_lengths[class_index];
-    my_cache.free_lists[class_index] = nullptr;
-    my_cache.list_lengths[class_index] = 0;
 }
 
-void* MyAllocator::allocate(size_t size) {
+// Free handles are chained through their entries' ptr fields; the table
+// grows one mmap'd chunk at a time and never shrinks, so entries stay put.
+MyAllocator::Handle MyAllocator::acquireHandle() {
+    std::lock_guard<ProfiledMutex> lock(handle_mtx);
+    if (free_handles != 0) {
+        Handle handle{free_handles};
+        free_handles = (uint32_t)(uintptr_t)movableEntry(handle).ptr.load(std::memory_order_relaxed);
+        return handle;
+    }
+    if (handles_used == HANDLE_CHUNKS * HANDLE_CHUNK_ENTRIES) return Handle{};
+    size_t chunk = handles_used / HANDLE_CHUNK_ENTRIES;
+    if (handle_chunks[chunk].load(std::memory_order_relaxed) == nullptr) {
+        void* entries = mmap(nullptr, HANDLE_CHUNK_ENTRIES * sizeof(MovableEntry), PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (entries == MAP_FAILED) return Handle{};
+        handle_chunks[chunk].store((MovableEntry*)entries, std::memory_order_release);
+    }
+    return Handle{(uint32_t)++handles_used};
+}
+
+void MyAllocator::releaseHandle(Handle handle) {
+    std::lock_guard<ProfiledMutex> lock(handle_mtx);
+    movableEntry(handle).ptr.store((char*)(uintptr_t)free_handles, std::memory_order_relaxed);
+    free_handles = handle.id;
+}
+
+void MyAllocator::linkSpan(Span*& list, Span* span) {
+    span->prev = nullptr;
+    span->next = list;
+    if (list) list->prev = span;
+    list = span;
+}
+
+void MyAllocator::unlinkSpan(Span*& list, Span* span) {
+    if (span->prev) span->prev->next = span->next;
+    else list = span->next;
+    if (span->next) span->next->prev = span->prev;
+}
+
+// Maps a span for the class and threads its slots' payloads onto the span's
+// own free list. Slot headers start zeroed, marking the slots free. Caller
+// holds pool.mtx.
+bool MyAllocator::refillMovablePool(MovablePool& pool, size_t class_index, int node) {
+    size_t num_pages = refillPages(class_index);
+    size_t span_bytes = num_pages << PAGE_SHIFT;
+    if (!reserveBytes(span_bytes)) return false;
+    Span* span = arenas[node].page_heap.allocateSpan(num_pages, node);
+    if (span == nullptr) {
+        unreserveBytes(span_bytes);
+        return false;
+    }
+    span->size_class = (int)class_index;
+    span->movable = true;
+    movable_span_bytes.fetch_add(span_bytes, std::memory_order_relaxed);
+
+    size_t block_size = getClassSizeFromIndex(class_index) + sizeof(BlockHeader);
+    char* payloads = (char*)(span->start_page_id << PAGE_SHIFT) + sizeof(BlockHeader);
+    SpanInit::threadBlocks(payloads, span_bytes / block_size, block_size, 0, 0, linkKey());
+    span->free_slots = (FreeBlockHeader*)payloads;
+    linkSpan(pool.partial, span);
+    return true;
+}
+
+MyAllocator::Handle MyAllocator::allocate_movable(size_t size) {
+    if (size == 0) return Handle{};
+    Handle handle = acquireHandle();
+    if (!handle) return Handle{};
+    MovableEntry& entry = movableEntry(handle);
+    if (size > MAX_SMALL_ALLOC_SIZE) {
+        char* ptr = (char*)allocate(size);
+        if (ptr == nullptr) {
+            releaseHandle(handle);
+            return Handle{};
+        }
+        entry.class_index = 8;
+        entry.ptr.store(ptr, std::memory_order_relaxed);
+        return handle;
+    }
+
+    size_t class_index = getSizeClassIndex(size);
+    size_t class_size = getClassSizeFromIndex(class_index);
+    int node = currentNode();
+    MovablePool& pool = movable_pools[class_index];
+    bool done = false;
+    do {
+        std::lock_guard<ProfiledMutex> lock(pool.mtx);
+        if (pool.partial != nullptr || refillMovablePool(pool, class_index, node)) {
+            Span* span = pool.partial;
+            FreeBlockHeader* slot = span->free_slots;
+            span->free_slots = nextOf(slot);
+            if (span->free_slots == nullptr) {
+                unlinkSpan(pool.partial, span);
+                linkSpan(pool.full, span);
+            }
+            span->live_slots++;
+            *((uint64_t*)slot - 1) = handle.id;
+            entry.class_index = (uint8_t)class_index;
+            entry.node = (uint8_t)span->node;
+            entry.ptr.store((char*)slot, std::memory_order_relaxed);
+            movable_live_bytes.fetch_add(class_size, std::memory_order_relaxed);
+            done = true;
+        }
+    } while (handleBudgetEvents(refillPages(class_index) << PAGE_SHIFT) && !done);
+    if (!done) {
+        releaseHandle(handle);
+        return Handle{};
+    }
+    return handle;
+}
+
+// Empty spans stay mapped until the next compact() or trim(), so a cache
+// that shrinks and regrows does not remap them.
+void MyAllocator::deallocate_movable(Handle handle) {
+    if (!handle) return;
+    MovableEntry& entry = movableEntry(handle);
+#ifdef MYALLOC_HARDENED
+    if (entry.pins.load(std::memory_order_relaxed) != 0) {
+        reportHeapCorruption("free of pinned movable object", entry.ptr.load(std::memory_order_relaxed));
+    }
+#endif
+    if (entry.class_index >= 8) {
+        deallocate(entry.ptr.load(std::memory_order_relaxed));
+    } else {
+        MovablePool& pool = movable_pools[entry.class_index];
+        std::lock_guard<ProfiledMutex> lock(pool.mtx);
+        // Read under the lock: compact() may have moved the object.
+        FreeBlockHeader* slot = (FreeBlockHeader*)entry.ptr.load(std::memory_order_relaxed);
+        Span* span = arenas[entry.node].page_heap.lookupSpan(slot);
+        *((uint64_t*)slot - 1) = 0;
+        if (span->free_slots == nullptr) {
+            unlinkSpan(pool.full, span);
+            linkSpan(pool.partial, span);
+        }
+        pushBlock(slot, span->free_slots);
+        span->free_slots = slot;
+        span->live_slots--;
+        movable_live_bytes.fetch_sub(getClassSizeFromIndex(entry.class_index), std::memory_order_relaxed);
+    }
+    releaseHandle(handle);
+}
+
+size_t MyAllocator::compact() {
+    size_t released = 0;
+    for (size_t index = 0; index < 8; ++index) released += compactPool(index);
+    compacted_bytes.fetch_add(released, std::memory_order_relaxed);
+    return released;
+}
+
+// Copies one object into a free slot of another span unless it is pinned.
+// PIN_MOVING holds off new pins for the copy; the acquire CAS also makes the
+// last pinner's writes visible before they are copied. Caller holds the
+// pool lock.
+bool MyAllocator::moveObject(char* slot, Span* from, Span* to, size_t class_size) {
+    Handle handle{(uint32_t)*((uint64_t*)slot - 1)};
+    MovableEntry& entry = movableEntry(handle);
+    uint32_t unpinned = 0;
+    if (!entry.pins.compare_exchange_strong(unpinned, PIN_MOVING, std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+        return false;
+    }
+    FreeBlockHeader* target = to->free_slots;
+    to->free_slots = nextOf(target);
+    memcpy(target, slot, class_size);
+    *((uint64_t*)target - 1) = handle.id;
+    entry.node = (uint8_t)to->node;
+    entry.ptr.store((char*)target, std::memory_order_relaxed);
+    entry.pins.store(0, std::memory_order_release);
+
+    *((uint64_t*)slot - 1) = 0;
+    pushBlock((FreeBlockHeader*)slot, from->free_slots);
+    from->free_slots = (FreeBlockHeader*)slot;
+    from->live_slots--;
+    to->live_slots++;
+    return true;
+}
+
+// Sorts the partial spans by occupancy and picks the longest run of the
+// sparsest whose objects all fit into the free slots of the rest. Those are
+// emptied into the fullest spans first, and every span left empty (unless a
+// pin kept an object in it) is unmapped after the lock is dropped.
+size_t MyAllocator::compactPool(size_t class_index) {
+    size_t class_size = getClassSizeFromIndex(class_index);
+    size_t block_size = class_size + sizeof(BlockHeader);
+    MovablePool& pool = movable_pools[class_index];
+    Span* victims = nullptr;
+    {
+        std::lock_guard<ProfiledMutex> lock(pool.mtx);
+        std::vector<Span*, InternalAllocator<Span*>> spans;
+        for (Span* span = pool.partial; span; span = span->next) spans.push_back(span);
+        if (spans.empty()) return 0;
+        std::sort(spans.begin(), spans.end(),
+                  [](const Span* a, const Span* b) { return a->live_slots < b->live_slots; });
+
+        auto capacity = [&](const Span* span) { return (span->num_pages << PAGE_SHIFT) / block_size; };
+        size_t free_slots = 0;
+        for (const Span* span : spans) free_slots += capacity(span) - span->live_slots;
+        size_t sources = 0, moving = 0;
+        while (sources < spans.size()) {
+            const Span* span = spans[sources];
+            size_t room = free_slots - (capacity(span) - span->live_slots);
+            if (moving + span->live_slots > room) break;
+            moving += span->live_slots;
+            free_slots = room;
+            ++sources;
+        }
+
+        size_t target = spans.size() - 1;
+        size_t moved = 0;
+        for (size_t i = 0; i < sources; ++i) {
+            Span* from = spans[i];
+            char* slot = (char*)(from->start_page_id << PAGE_SHIFT) + sizeof(BlockHeader);
+            for (size_t n = capacity(from); n > 0 && from->live_slots > 0; --n, slot += block_size) {
+                if (*((uint64_t*)slot - 1) == 0) continue;
+                while (target >= sources && spans[target]->free_slots == nullptr) --target;
+                if (target < sources) break;
+                if (moveObject(slot, from, spans[target], class_size)) ++moved;
+            }
+        }
+        movable_moves.fetch_add(moved, std::memory_order_relaxed);
+
+        // Relink densest first, so new objects fill the fullest spans.
+        pool.partial = nullptr;
+        for (Span* span : spans) {
+            if (span->live_slots == 0) {
+                span->next = victims;
+                victims = span;
+            } else if (span->free_slots == nullptr) {
+                linkSpan(pool.full, span);
+            } else {
+                linkSpan(pool.partial, span);
+            }
+        }
+    }
+    return unmapMovableSpans(victims);
+}
+
+// Movable spans emptied by frees; trim() releases them like free small spans.
+size_t MyAllocator::releaseEmptyMovableSpans(size_t class_index, size_t& keep_bytes) {
+    MovablePool& pool = movable_pools[class_index];
+    Span* victims = nullptr;
+    {
+        std::lock_guard<ProfiledMutex> lock(pool.mtx);
+        for (Span* span = pool.partial, *next; span; span = next) {
+            next = span->next;
+            if (span->live_slots != 0) continue;
+            size_t span_bytes = span->num_pages << PAGE_SHIFT;
+            if (keep_bytes >= span_bytes) {
+                keep_bytes -= span_bytes;
+                continue;
+            }
+            unlinkSpan(pool.partial, span);
+            span->next = victims;
+            victims = span;
+        }
+    }
+    return unmapMovableSpans(victims);
+}
+
+size_t MyAllocator::unmapMovableSpans(Span* spans) {
+    size_t released = 0;
+    while (spans) {
+        Span* span = spans;
+        spans = span->next;
+        size_t span_bytes = span->num_pages << PAGE_SHIFT;
+        arenas[span->node].page_heap.deallocateSpan(span);
+        unreserveBytes(span_bytes);
+        movable_span_bytes.fetch_sub(span_bytes, std::memory_order_relaxed);
+        released += span_bytes;
+    }
+    return released;
+}
+
+// Pages for a large block, rounded up to its cache bucket while the large
+// cache is enabled.
+size_t MyAllocator::largeSpanPages(size_t size) const {
+    size_t num_pages = (size + sizeof(BlockHeader) + PAGE_BYTES - 1) >> PAGE_SHIFT;
+    if (tunables.large_cache_bytes.load(std::memory_order_relaxed) != 0) {
+        size_t bucket = largeBucketIndex(num_pages);
+        if (bucket < LARGE_BUCKETS) num_pages = largeBucketPages(bucket);
+    }
+    return num_pages;
+}
+
+// Large requests, and size 0, which wraps past the small-size check.
+void* MyAllocator::allocateLarge(size_t size) {
+    if (size == 0 || size > MAX_LARGE_ALLOC_SIZE) return nullptr;
+
+    size_t num_pages = largeSpanPages(size);
+    int node = currentNode();
+
+    Span* span = nullptr;
+    if (largeBucketIndex(num_pages) < LARGE_BUCKETS) span = takeCachedSpan(num_pages, node);
+    size_t span_bytes = num_pages << PAGE_SHIFT;
+
+    while (span == nullptr) {
+        if (reserveBytes(span_bytes)) {
+            span = arenas[node].page_heap.allocateSpan(num_pages, node);
+            if (span == nullptr) unreserveBytes(span_bytes);
+        }
+        if (span == nullptr && !handleBudgetEvents(span_bytes)) return nullptr;
+    }
+    handleBudgetEvents(span_bytes);
+
+    MyAllocator::BlockHeader* header = (MyAllocator::BlockHeader*)(span->start_page_id << PAGE_SHIFT);
+    header->size = size;
+    header->node = node;
+    return (void*)(header + 1);
+}
+
+// Refills an empty thread cache list; called with the class's list and bump
+// region both empty. Prefers blocks other threads returned and maps a new
+// bump region only if there are none. Heap budget events the refill raised
+// are acted on once the transfer cache lock is released.
+bool MyAllocator::refillThreadCache(size_t class_index) {
+    FreeList& list = my_cache.lists[class_index];
+    BumpRegion& bump = my_cache.bump[class_index];
+    checkFlushRequest(class_index);
+    do {
+        if (fetchFromTransferCache(class_index) == 0) refillBumpRegion(class_index);
+    } while (handleBudgetEvents(refillPages(class_index) << PAGE_SHIFT, class_index) &&
+             list.head == nullptr && bump.next == bump.end);
+    return list.head != nullptr || bump.next != bump.end;
+}
+
+// Thread cache miss: cut the next block from the bump region, refilling
+// first if that is used up too.
+void* MyAllocator::allocateSmallSlow(size_t index, bool* known_zero) {
+    BumpRegion& bump = my_cache.bump[index];
+    if (bump.next == bump.end) {
+        if (!refillThreadCache(index)) return nullptr;
+        FreeBlockHeader* head = my_cache.lists[index].head;
+        if (head != nullptr) {
+            if (known_zero) *known_zero = isKnownZero(head);
+            return popSmall(index);
+        }
+    }
+
+    FreeBlockHeader* block = (FreeBlockHeader*)bump.next;
+    bump.next += getClassSizeFromIndex(index) + sizeof(BlockHeader);
+    countEvent(my_cache.counters.blocks_carved[index]);
+    if (known_zero) *known_zero = true;
+    return initSmallBlock(block, getClassSizeFromIndex(index), my_cache.node);
+}
+
+void* MyAllocator::allocate_zeroed(size_t count, size_t size) {
+    if (count != 0 && size > SIZE_MAX / count) return nullptr;
+    size *= count;
     if (size == 0) return nullptr;
 
     // --- Large Allocation Path ---
     if (size > MAX_SMALL_ALLOC_SIZE) {
-        size_t total_size = size + sizeof(MyAllocator::BlockHeader);
-        size_t num_pages = (total_size + 4095) >> PAGE_SHIFT;
-        Span* span = page_heap.allocateSpan(num_pages);
-        if (span == nullptr) return nullptr;
+        void* ptr = allocateLarge(size);
+        if (ptr == nullptr) return nullptr;
+        BlockHeader* header = (BlockHeader*)ptr - 1;
+        Span* span = arenas[header->node].page_heap.lookupSpan(header);
+        if (span == nullptr || !span->zeroed) zeroFill(ptr, size);
+#ifdef MYALLOC_TRACING
+        traceEvent(TRACE_ALLOC_ZEROED, size, ptr);
+#endif
+        return ptr;
+    }
 
-        MyAllocator::BlockHeader* header = (MyAllocator::BlockHeader*)(span->start_page_id << PAGE_SHIFT);
-        header->size = size;
-        return (void*)(header + 1);
+    // --- Small Allocation Path ---
+    size_t index = getSizeClassIndex(size);
+    FreeBlockHeader* head = my_cache.lists[index].head;
+    bool known_zero;
+    void* ptr;
+    if (head != nullptr) {
+        countEvent(my_cache.counters.fast_path_hits[index]);
+        known_zero = isKnownZero(head);
+        ptr = popSmall(index);
+    } else {
+        ptr = allocateSmallSlow(index, &known_zero);
+        if (ptr == nullptr) return nullptr;
+    }
+    if (!known_zero) memset(ptr, 0, size);
+#ifdef MYALLOC_TRACING
+    traceEvent(TRACE_ALLOC_ZEROED, size, ptr);
+#endif
+    return ptr;
+}
+
+size_t MyAllocator::allocate_batch(size_t size, size_t count, void** out) {
+    if (size == 0 || count == 0) return 0;
+
+    // --- Large Allocation Path ---
+    if (size > MAX_SMALL_ALLOC_SIZE) {
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = allocate(size);
+            if (out[i] == nullptr) return i;
+        }
+        return count;
     }
 
     // --- Small Allocation Path ---
     size_t index = getSizeClassIndex(size);
-    if (index >= 8) return nullptr;
-    
-    if (my_cache.free_lists[index] == nullptr) {
-        fetchFromTransferCache(index);
-        if (my_cache.free_lists[index] == nullptr) return nullptr;
+    size_t class_size = getClassSizeFromIndex(index);
+    int node = currentNode();
+    size_t done = 0;
+
+    // Drain the thread cache first, then take the remainder from the
+    // transfer cache as one segment under a single lock acquisition.
+    FreeBlockHeader* block = my_cache.lists[index].head;
+    while (done < count && block) {
+        FreeBlockHeader* next = nextOf(block);
+        out[done++] = initSmallBlock(block, class_size, node);
+        block = next;
     }
+    my_cache.lists[index].head = block;
+    my_cache.lists[index].length -= (int)done;
 
-    FreeBlockHeader* block = my_cache.free_lists[index];
-    my_cache.free_lists[index] = block->next;
-    my_cache.list_lengths[index]--;
+    // Then cut fresh blocks straight from the bump region, then take returned
+    // blocks from the transfer cache, and only then map a new region.
+    BumpRegion& bump = my_cache.bump[index];
+    size_t block_size = class_size + sizeof(BlockHeader);
+    while (done < count) {
+        // Fresh blocks need only their header (the hardened canary is
+        // already zero), so they are exported in bulk.
+        size_t before = done;
+        size_t cut = std::min(count - done, (size_t)(bump.end - bump.next) / block_size);
+        SpanInit::exportBlocks(bump.next, cut, block_size, headerWord(class_size, node), out + done);
+        bump.next += cut * block_size;
+        done += cut;
+        countEvent(my_cache.counters.blocks_carved[index], done - before);
+        if (done == count) break;
 
-    MyAllocator::BlockHeader* header = (MyAllocator::BlockHeader*)block;
-    header->size = getClassSizeFromIndex(index);
-    return (void*)(header + 1);
+        size_t carved = done;
+        fetchRange(index, count - done, &block);
+        while (block) {
+            FreeBlockHeader* next = nextOf(block);
+            out[done++] = initSmallBlock(block, class_size, node);
+            block = next;
+        }
+        if (done == carved) refillBumpRegion(index);
+        bool retry = handleBudgetEvents(refillPages(index) << PAGE_SHIFT, index);
+        if (done == before && bump.next == bump.end && !retry) break;
+    }
+#ifdef MYALLOC_TRACING
+    for (size_t i = 0; i < done; ++i) traceEvent(TRACE_ALLOC, size, out[i]);
+#endif
+    return done;
+}
+
+void MyAllocator::deallocate_batch(void** ptrs, size_t count) {
+    int node = currentNode();
+    unsigned touched_classes = 0;
+    int scavenge_threshold = tunables.scavenge_threshold.load(std::memory_order_relaxed);
+
+    for (size_t i = 0; i < count; ++i) {
+        if (ptrs[i] == nullptr) continue;
+#ifdef MYALLOC_TRACING
+        traceEvent(TRACE_FREE, 0, ptrs[i]);
+#endif
+#ifdef MYALLOC_HARDENED
+        validateFree(ptrs[i]);
+#endif
+        BlockHeader* header = (BlockHeader*)((char*)ptrs[i] - sizeof(BlockHeader));
+        if (header->size > MAX_SMALL_ALLOC_SIZE) {
+            if (header->size & LONG_LIVED_FLAG) deallocateLongLived(header);
+            else deallocateLarge(header);
+            continue;
+        }
+
+        size_t index = getSizeClassIndex(header->size);
+        FreeBlockHeader* block = (FreeBlockHeader*)header;
+        if ((int)header->node != node) {
+            releaseRemoteBlock(block, index, header->node);
+            continue;
+        }
+
+        pushBlock(block, my_cache.lists[index].head);
+        my_cache.lists[index].head = block;
+        my_cache.lists[index].length++;
+        touched_classes |= 1u << index;
+    }
+
+    // Hand oversized lists back as whole segments, one lock per class
+    for (size_t index = 0; index < 8; ++index) {
+        if ((touched_classes & (1u << index)) &&
+            my_cache.lists[index].length > scavenge_threshold) {
+            scavenge(index);
+        }
+    }
+}
+
+#ifdef MYALLOC_HARDENED
+// Checks that ptr is the start of a live block the allocator handed out, then
+// stamps it as freed. Must run before the header is trusted or overwritten.
+void MyAllocator::validateFree(void* ptr) {
+    BlockHeader* header = (BlockHeader*)((char*)ptr - sizeof(BlockHeader));
+    Span* span = nullptr;
+    for (int node = 0; node < numaNodeCount() && span == nullptr; ++node) {
+        span = arenas[node].page_heap.lookupSpan(header);
+    }
+    if (span == nullptr) {
+        // The thread cache is shared by every instance, so this one may have
+        // handed out a block of another live instance.
+        std::lock_guard<std::mutex> lock(instance_mutex);
+        for (MyAllocator* a = instance_list; a && span == nullptr; a = a->next_instance) {
+            for (int node = 0; a != this && node < numaNodeCount() && span == nullptr; ++node) {
+                span = a->arenas[node].page_heap.lookupSpan(header);
+            }
+        }
+    }
+    if (span == nullptr) reportHeapCorruption("free of pointer not owned by the allocator", ptr);
+
+    char* span_start = (char*)(span->start_page_id << PAGE_SHIFT);
+    if (span->size_class < 0) {
+        if (span->is_free) reportHeapCorruption("double free", ptr);
+        if ((char*)header != span_start || header->size <= MAX_SMALL_ALLOC_SIZE) {
+            reportHeapCorruption("invalid free of large block", ptr);
+        }
+        return;
+    }
+
+    if (span->movable) reportHeapCorruption("deallocate of movable object", ptr);
+    uintptr_t* canary = (uintptr_t*)ptr;
+    if (*canary == freeCanary(header)) reportHeapCorruption("double free", ptr);
+
+    size_t class_size = getClassSizeFromIndex(span->size_class);
+    size_t offset = (char*)header - span_start;
+    bool long_lived = (header->size & LONG_LIVED_FLAG) != 0;
+    if (offset % (class_size + sizeof(BlockHeader)) != 0 || long_lived != span->long_lived ||
+        (header->size & ~LONG_LIVED_FLAG) != class_size || (int)header->node != span->node) {
+        reportHeapCorruption("free of misaligned or corrupted block", ptr);
+    }
+    *canary = freeCanary(header);
+}
+#endif
+
+void MyAllocator::deallocateLarge(BlockHeader* header) {
+    PageHeap& page_heap = arenas[header->node].page_heap;
+    Span* span = page_heap.lookupSpan(header);
+    if (span == nullptr || cacheLargeSpan(span)) return;
+    size_t span_bytes = span->num_pages << PAGE_SHIFT;
+    page_heap.deallocateSpan(span);
+    unreserveBytes(span_bytes);
+}
+
+void* MyAllocator::reallocate(void* ptr, size_t new_size) {
+    if (ptr == nullptr) return allocate(new_size);
+    if (new_size == 0) {
+        deallocate(ptr);
+        return nullptr;
+    }
+    // Checked before the span math below, which would wrap, and before the
+    // size is written into the header, where it would set LONG_LIVED_FLAG.
+    if (new_size > MAX_LARGE_ALLOC_SIZE) return nullptr;
+
+    BlockHeader* header = (BlockHeader*)ptr - 1;
+    size_t old_size = header->size & ~LONG_LIVED_FLAG; // Class size for small blocks
+    bool long_lived = (header->size & LONG_LIVED_FLAG) != 0;
+    bool in_place;
+    if (old_size > MAX_SMALL_ALLOC_SIZE) {
+        // Keep the span while the new size needs at least half of it.
+        Span* span = arenas[header->node].page_heap.lookupSpan(header);
+        if (span == nullptr) return nullptr;
+        size_t needed = largeSpanPages(new_size);
+        in_place = new_size > MAX_SMALL_ALLOC_SIZE && needed <= span->num_pages &&
+                   needed > span->num_pages / 2;
+        if (in_place) header->size = new_size;
+    } else {
+        in_place = getSizeClassIndex(new_size) == getSizeClassIndex(old_size);
+    }
+
+    if (in_place) {
+#ifdef MYALLOC_TRACING
+        traceEvent(TRACE_FREE, 0, ptr);
+        traceEvent(TRACE_ALLOC, new_size, ptr);
+#endif
+        return ptr;
+    }
+
+    void* new_ptr = long_lived ? allocate(new_size, Lifetime::Long) : allocate(new_size);
+    if (new_ptr == nullptr) return nullptr;
+    memcpy(new_ptr, ptr, std::min(old_size, new_size));
+    deallocate(ptr);
+    return new_ptr;
 }
 
 void MyAllocator::deallocate(void* ptr) {
     if (ptr == nullptr) return;
+#ifdef MYALLOC_TRACING
+    traceEvent(TRACE_FREE, 0, ptr);
+#endif
+#ifdef MYALLOC_HARDENED
+    validateFree(ptr);
+#endif
 
     MyAllocator::BlockHeader* header = (MyAllocator::BlockHeader*)((char*)ptr - sizeof(MyAllocator::BlockHeader));
     size_t size = header->size;
+    int node = header->node;
 
     // --- Large Deallocation Path ---
     if (size > MAX_SMALL_ALLOC_SIZE) {
-        Span* span = page_heap.lookupSpan(header);
-        if (span == nullptr) return;
-        page_heap.deallocateSpan(span);
+        if (size & LONG_LIVED_FLAG) deallocateLongLived(header);
+        else deallocateLarge(header);
         return;
     }
 
@@ -215,11 +2066,17 @@ void MyAllocator::deallocate(void* ptr) {
     if (index >= 8) return;
     
     FreeBlockHeader* block = (FreeBlockHeader*)header;
-    block->next = my_cache.free_lists[index];
-    my_cache.free_lists[index] = block;
-    my_cache.list_lengths[index]++;
+    if (node != currentNode()) {
+        releaseRemoteBlock(block, index, node);
+        return;
+    }
 
-    if (my_cache.list_lengths[index] > SCAVENGE_THRESHOLD) {
-        releaseToTransferCache(index);
+    FreeList& list = my_cache.lists[index];
+    pushBlock(block, list.head);
+    list.head = block;
+    list.length++;
+
+    if (list.length > tunables.scavenge_threshold.load(std::memory_order_relaxed)) {
+        scavenge(index);
     }
 }
@@ -2,21 +2,343 @@
 
 #pragma once
 
+#include <atomic>  // For cross-node statistics
 #include <cstddef> // For size_t
+#include <cstdint> // For uintptr_t
+#include <climits> // For INT_MAX
+#include <cstdlib> // For std::malloc and std::free
 #include <mutex>   // For std::mutex
 #include <unordered_map> // For the PageHeap's page map
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // For __rdtsc in the lock profiler
+#else
+#include <chrono>
+#endif
+
+// STL allocator for the allocator's own bookkeeping. Going straight to malloc
+// keeps internal containers from re-entering MyAllocator through a replaced
+// operator new, including when they are destroyed at exit.
+template <typename T>
+struct InternalAllocator {
+    using value_type = T;
+    InternalAllocator() = default;
+    template <typename U> InternalAllocator(const InternalAllocator<U>&) {}
+    T* allocate(size_t n) { return static_cast<T*>(std::malloc(n * sizeof(T))); }
+    void deallocate(T* p, size_t) { std::free(p); }
+    template <typename U> bool operator==(const InternalAllocator<U>&) const { return true; }
+    template <typename U> bool operator!=(const InternalAllocator<U>&) const { return false; }
+};
+
+// --- Size Classes ---
+constexpr size_t SIZE_CLASSES[] = {8, 16, 32, 64, 128, 256, 512, 1024};
+constexpr size_t MAX_SMALL_ALLOC_SIZE = 1024;
+
+// Maps (size + 7) / 8 to its class index, so a lookup is one load at run
+// time and folds away entirely when the size is a constant.
+struct SizeClassTable {
+    unsigned char index[MAX_SMALL_ALLOC_SIZE / 8 + 1];
+};
+
+constexpr SizeClassTable makeSizeClassTable() {
+    SizeClassTable table{};
+    size_t class_index = 0;
+    for (size_t slot = 0; slot <= MAX_SMALL_ALLOC_SIZE / 8; ++slot) {
+        while (SIZE_CLASSES[class_index] < slot * 8) ++class_index;
+        table.index[slot] = (unsigned char)class_index;
+    }
+    return table;
+}
+
+constexpr SizeClassTable SIZE_CLASS_TABLE = makeSizeClassTable();
+
+// --- Span Layout ---
+// Pages per span for each class: the fewest pages (up to MAX_SPAN_PAGES)
+// that leave at most 1/32 of the span as tail waste once it is cut into
+// header + object blocks. A 1032-byte block wastes 25% of a single page but
+// 2.8% of seven. batch is the default transfer batch, capped at one span's
+// worth of blocks so a refill usually maps at most one span.
+constexpr size_t PAGE_BYTES = 4096;
+constexpr size_t MAX_SPAN_PAGES = 16;
+constexpr size_t DEFAULT_TRANSFER_BATCH = 32;
+
+struct SpanLayoutTable {
+    size_t pages[8];
+    size_t objects[8];
+    size_t batch[8];
+};
+
+constexpr SpanLayoutTable makeSpanLayoutTable() {
+    SpanLayoutTable table{};
+    for (size_t i = 0; i < 8; ++i) {
+        size_t block = SIZE_CLASSES[i] + sizeof(size_t); // BlockHeader is one word
+        size_t pages = 1;
+        while (pages < MAX_SPAN_PAGES && (pages * PAGE_BYTES % block) * 32 > pages * PAGE_BYTES) {
+            ++pages;
+        }
+        table.pages[i] = pages;
+        table.objects[i] = pages * PAGE_BYTES / block;
+        table.batch[i] = table.objects[i] < DEFAULT_TRANSFER_BATCH ? table.objects[i] : DEFAULT_TRANSFER_BATCH;
+    }
+    return table;
+}
+
+constexpr SpanLayoutTable SPAN_LAYOUT = makeSpanLayoutTable();
+static_assert(SPAN_LAYOUT.pages[7] > 1, "the 1024-byte class needs a multi-page span");
 
 class MyAllocator {
 public:
-    void* allocate(size_t size);
+    MyAllocator();
+    ~MyAllocator();
+
+    // Inline so that callers (operator new in particular) get the thread
+    // cache pop without a call; misses and large sizes go out of line.
+    void* allocate(size_t size) {
+#ifdef MYALLOC_TRACING
+        void* ptr = size - 1 < MAX_SMALL_ALLOC_SIZE ? allocateSmall(getSizeClassIndex(size))
+                                                    : allocateLarge(size);
+        traceEvent(TRACE_ALLOC, size, ptr);
+        return ptr;
+#else
+        if (size - 1 < MAX_SMALL_ALLOC_SIZE) return allocateSmall(getSizeClassIndex(size));
+        return allocateLarge(size);
+#endif
+    }
     void deallocate(void* ptr);
 
-    // Hidden header for ALL allocations. Stores the size.
+    // Allocation with the size known at compile time, e.g. allocate<sizeof(T)>().
+    // The class index is a constant, leaving a TLS load, a pop, a branch and
+    // the thread's fast-path hit count (a plain load and store).
+    template <size_t N>
+    void* allocate() {
+        static_assert(N > 0, "allocate<0>() is meaningless");
+#ifdef MYALLOC_TRACING
+        return allocate(N); // Keep one recording point
+#else
+        if constexpr (N > MAX_SMALL_ALLOC_SIZE) {
+            return allocateLarge(N);
+        } else {
+            constexpr size_t index = getSizeClassIndex(N);
+            return allocateSmall(index);
+        }
+#endif
+    }
+
+    // realloc equivalent. Keeps the block when the new size maps to the same
+    // size class or span; otherwise moves the contents to a new block. On
+    // failure the old block is left intact and nullptr is returned.
+    void* reallocate(void* ptr, size_t new_size);
+
+    // calloc equivalent: count * size zero-filled bytes, nullptr on overflow
+    // or when the product is too large to map.
+    // Memory known to be untouched since mmap is returned without a memset.
+    void* allocate_zeroed(size_t count, size_t size);
+
+    // Bulk variants for building many objects at once. allocate_batch fills
+    // out[0..n) and returns n, which is less than count only when out of memory.
+    size_t allocate_batch(size_t size, size_t count, void** out);
+    void deallocate_batch(void** ptrs, size_t count);
+
+    // --- Lifetime Hints ---
+    // Small blocks expected to outlive the churn around them (caches,
+    // session state, interned strings) can be placed in a separate span pool,
+    // so they never pin spans that are otherwise full of freed short-lived
+    // blocks. The long-lived pool has no thread cache: each call takes the
+    // node's pool lock. Free with deallocate() as usual; reallocate() keeps
+    // the pool. Large sizes ignore the hint.
+    enum class Lifetime : uint8_t { Short, Long };
+    void* allocate(size_t size, Lifetime lifetime);
+
+    // --- Coroutine Frames ---
+    // For objects whose size is known again when they are freed, such as
+    // coroutine frames allocated through a promise_type's operator new and
+    // sized operator delete. Frames of up to MAX_FRAME_SIZE bytes are taken
+    // from per-thread LIFO stacks of fixed-size slots with no header, so a
+    // create/destroy pair is a push and a pop; larger ones use allocate().
+    // Slots are cut from dedicated spans that stay mapped for reuse. A frame
+    // may be freed on any thread, with the size it was allocated with.
+    static constexpr size_t FRAME_GRANULE = 64;
+    static constexpr size_t MAX_FRAME_SIZE = 4096;
+    void* allocate_frame(size_t size);
+    void deallocate_frame(void* ptr, size_t size);
+
+    // --- Movable Objects ---
+    // For long-running caches whose spans would otherwise end up sparsely
+    // used. allocate_movable() returns a handle instead of a pointer; pin()
+    // yields the object's current address and keeps it there until the
+    // matching unpin(). compact() relocates unpinned objects out of the
+    // sparsest spans into the fullest ones and unmaps the spans it empties,
+    // so it can run on a background thread while others pin and unpin. Pins
+    // nest, cost one atomic each and work from any thread; an object may only
+    // be touched while pinned. Sizes above MAX_SMALL_ALLOC_SIZE get a block of
+    // their own that never moves. Allocating and freeing take the size
+    // class's pool lock. A null handle means failure.
+    struct Handle {
+        uint32_t id = 0;
+        explicit operator bool() const { return id != 0; }
+    };
+    Handle allocate_movable(size_t size);
+    void deallocate_movable(Handle handle); // The handle must not be pinned
+    template <typename T = void>
+    T* pin(Handle handle) { return static_cast<T*>(pinAddress(handle)); }
+    void unpin(Handle handle);
+    size_t compact(); // Returns the bytes unmapped
+
+    // Hardened builds (-DMYALLOC_HARDENED) encode free-list links and
+    // validate every pointer passed to deallocate, aborting on misuse.
+#ifdef MYALLOC_HARDENED
+    static constexpr bool HARDENED = true;
+#else
+    static constexpr bool HARDENED = false;
+#endif
+
+    // The small-object pop prefetches the following free block so the next
+    // pop does not stall on it; -DMYALLOC_NO_PREFETCH turns this off.
+#ifdef MYALLOC_NO_PREFETCH
+    static constexpr bool PREFETCH = false;
+#else
+    static constexpr bool PREFETCH = true;
+#endif
+
+    // Upper bound on NUMA partitions; machines with more nodes fold onto these.
+    static constexpr int MAX_NUMA_NODES = 8;
+
+    // --- Heap Budget ---
+    // Limits apply to bytes mapped from the OS; 0 disables a limit. Crossing
+    // the soft limit flushes the thread's cache back to the shared tiers,
+    // unmaps whatever spans that leaves entirely free (as trim(0) would) and
+    // fires the callback once per crossing. While the heap stays above it,
+    // mappings repeat the flush and release at most once per
+    // SOFT_LIMIT_RELEASE_MS, so a heap hovering at the limit does not rescan
+    // its caches on every refill. At the hard limit an allocation
+    // that needs fresh pages calls the callback instead, retrying for as long
+    // as it returns true (like std::new_handler), and fails with nullptr
+    // otherwise.
+    static constexpr uint64_t SOFT_LIMIT_RELEASE_MS = 100;
+    enum class MemoryEvent { SoftLimit, HardLimit };
+    using MemoryCallback = bool (*)(MemoryEvent event, size_t requested_bytes, void* arg);
+    void setMemoryLimits(size_t soft_limit, size_t hard_limit);
+    void setMemoryCallback(MemoryCallback callback, void* arg);
+
+    // --- Heap Trimming ---
+    // Returns cached free memory to the OS, like malloc_trim. The calling
+    // thread's cache is flushed; other threads flush theirs at their next
+    // refill or scavenge. The large span caches are then unmapped, and so is
+    // every small span whose blocks are all back in its transfer cache, but
+    // up to keep_bytes of that free memory stays mapped for reuse. Frame
+    // spans (see allocate_frame) are never unmapped; movable spans are
+    // unmapped once empty, but only compact() empties them. Returns the bytes
+    // unmapped.
+    size_t trim(size_t keep_bytes = 0);
+
+    // --- Tunables ---
+    // Initialised from MYALLOC_* environment variables at construction and
+    // adjustable at run time; changes apply to subsequent refills and frees.
+    // The size-class table stays compile-time so allocate<N>() can fold it.
+    //   MYALLOC_SCAVENGE_THRESHOLD  thread cache list length that triggers a release (128)
+    //   MYALLOC_TRANSFER_BATCH      most blocks moved per thread cache refill (32); each
+    //                               class also caps it at one span (SPAN_LAYOUT.batch)
+    //   MYALLOC_REFILL_PAGES        minimum pages mapped per transfer cache refill (1);
+    //                               classes that need more for low waste use SPAN_LAYOUT
+    //   MYALLOC_RELEASE_POLICY      "all" (default) or "batch": how much a scavenge returns
+    //   MYALLOC_SOFT_LIMIT / MYALLOC_HARD_LIMIT  heap budget in bytes, K/M/G suffixes allowed
+    //   MYALLOC_LARGE_CACHE_BYTES   freed large spans kept per node for reuse, 0 disables (32M)
+    //   MYALLOC_LARGE_CACHE_DECAY_MS  age after which a cached large span is unmapped (1000)
+    enum class Tunable {
+        ScavengeThreshold, TransferBatch, RefillPages, ReleasePolicy, SoftLimit, HardLimit,
+        LargeCacheBytes, LargeCacheDecayMs
+    };
+    static constexpr size_t RELEASE_ALL = 0;
+    static constexpr size_t RELEASE_BATCH = 1;
+    bool setTunable(Tunable tunable, size_t value); // false if value is out of range
+    size_t getTunable(Tunable tunable) const;
+
+    // --- Allocation Tracing ---
+    // Builds with -DMYALLOC_TRACING record every allocate/free into a
+    // per-thread buffer that is appended to the trace file when full and at
+    // thread exit. Tracing starts at construction if MYALLOC_TRACE names a
+    // file, or explicitly with startTrace(). The file is TRACE_MAGIC followed
+    // by TraceRecords in per-thread chunks; `replay` sorts them by time.
+    enum TraceOp : uint8_t { TRACE_ALLOC = 1, TRACE_ALLOC_ZEROED = 2, TRACE_FREE = 3 };
+    struct TraceRecord {
+        uint64_t timestamp_ns; // CLOCK_MONOTONIC
+        uint64_t ptr_id;       // Address at trace time, used only as an identity
+        uint32_t size;         // Requested bytes (0 for frees), saturated
+        uint16_t thread;       // Small per-trace thread number
+        uint8_t op;            // TraceOp
+        uint8_t reserved;
+    };
+#ifdef MYALLOC_TRACING
+    static constexpr bool TRACING = true;
+#else
+    static constexpr bool TRACING = false;
+#endif
+    static constexpr char TRACE_MAGIC[8] = {'M', 'Y', 'A', 'T', 'R', 'A', 'C', 'E'};
+    static bool startTrace(const char* path);
+    static void stopTrace();
+
+    // --- Statistics ---
+    // Event counts are kept per thread without atomic read-modify-writes and
+    // summed on demand; threads fold their counts into a global total when
+    // they exit. They are process-wide, shared by every MyAllocator instance.
+    // Lock timings sample one acquisition in LOCK_SAMPLE_INTERVAL per thread
+    // and are in rdtsc cycles.
+    static constexpr unsigned LOCK_SAMPLE_INTERVAL = 64;
+    struct ClassStats {
+        uint64_t fast_path_hits;    // Allocations served straight from the thread cache
+        uint64_t transfer_fetches;  // Thread cache refills from the transfer cache
+        uint64_t page_heap_refills; // Spans mapped for the class's bump regions
+        uint64_t blocks_carved;     // Blocks cut from those spans so far
+        uint64_t blocks_released;   // Blocks of spans unmapped again by trim()
+        uint64_t central_blocks;    // Blocks currently held by the transfer caches
+        uint64_t scavenges;         // Oversized thread cache lists handed back
+    };
+    struct LockStats {
+        uint64_t samples;     // Sampled acquisitions
+        uint64_t contended;   // Sampled acquisitions that found the lock taken
+        uint64_t wait_cycles; // Summed over samples
+        uint64_t hold_cycles; // Summed over samples
+    };
+
+    // Snapshot of allocator counters.
+    struct Stats {
+        size_t numa_nodes;          // Number of active partitions
+        size_t cross_node_frees;    // Small blocks freed by a thread on another node
+        size_t mapped_bytes;        // Bytes currently mapped from the OS
+        size_t soft_limit_events;   // Upward crossings of the soft limit
+        size_t hard_limit_failures; // Allocations refused at the hard limit
+        size_t large_cache_bytes;   // Freed large spans held in the central caches
+        size_t small_span_bytes;    // Spans carved into small blocks
+        size_t frame_span_bytes;    // Spans carved into coroutine frame slots
+        size_t page_heap_spans;     // Spans currently mapped by the page heaps
+        size_t cache_flushes;       // Whole thread caches handed back (trim, limits, exit)
+        size_t trimmed_bytes;       // Bytes unmapped by trim() so far
+        size_t movable_span_bytes;  // Spans carved into movable object slots
+        size_t movable_live_bytes;  // Slot bytes of live movable objects
+        size_t movable_moves;       // Objects relocated by compact()
+        size_t compacted_bytes;     // Bytes unmapped by compact() so far
+        ClassStats classes[8];
+        LockStats transfer_cache_locks[8]; // Per size class, summed over nodes
+        LockStats page_heap_lock;          // Summed over nodes
+        LockStats large_cache_lock;        // Summed over nodes
+    };
+    Stats getStats() const;
+
+    // Renders getStats() as OpenMetrics text (Prometheus exposition format,
+    // ending in "# EOF") into buffer, without allocating. Returns the full
+    // length like snprintf: the output was cut short if it is >= capacity.
+    size_t renderMetrics(char* buffer, size_t capacity) const;
+
+    // Hidden header for ALL allocations. Stores the size and home node.
+    // Long-lived small blocks also set LONG_LIVED_FLAG in size, which sends
+    // them through the (cold) large-size branch of the free path.
     struct BlockHeader {
-        size_t size;
+        size_t size : 56;
+        size_t node : 8;
     };
+    static_assert(sizeof(BlockHeader) == sizeof(size_t), "header must stay one word");
 
-    // Header for a free block within a list.
+    // Header for a free block within a list. The low bit of next is a tag
+    // marking the block itself as still zero-filled from a fresh mmap.
     struct FreeBlockHeader {
         FreeBlockHeader* next;
     };
@@ -28,43 +350,496 @@ public:
         Span* next = nullptr;
         Span* prev = nullptr;
         bool is_free = true;
+        bool zeroed = false; // Pages untouched since mmap
+        int size_class = -1; // Small-object class carved from this span, -1 for large
+        int node = 0;
+        uint64_t cached_ms = 0; // When a freed large span entered the large cache
+        bool long_lived = false; // Carved for the Lifetime::Long pool
+        size_t free_blocks = 0; // Scratch count for trim(), under the transfer cache lock
+        bool movable = false; // Carved for allocate_movable
+        size_t live_slots = 0; // Movable spans: slots holding an object
+        FreeBlockHeader* free_slots = nullptr; // Movable spans: free slots, linked through their payloads
+    };
+
+    // One size class in a ThreadCache. Head and length are touched together
+    // on every pop and push, so they are kept in the same 16 bytes.
+    struct FreeList {
+        FreeBlockHeader* head = nullptr;
+        int length = 0;
     };
 
-    // Per-thread private cache for small allocations.
-    struct ThreadCache {
-        FreeBlockHeader* free_lists[8] = {nullptr};
-        int list_lengths[8] = {0};
+    // A thread's stack of free frame slots of one size.
+    static constexpr size_t FRAME_CLASSES = MAX_FRAME_SIZE / FRAME_GRANULE;
+    static constexpr size_t FRAME_STACK_LIMIT = 64; // Deeper stacks go to the central pool
+    static constexpr size_t FRAME_SPAN_PAGES = 16;
+    struct FrameStack {
+        FreeBlockHeader* head = nullptr;
+        size_t depth = 0;
+    };
+
+    // Large spans a thread keeps for itself before using the central cache.
+    static constexpr size_t LARGE_THREAD_SLOTS = 4;
+    static constexpr size_t LARGE_THREAD_CACHE_BYTES = 1 << 20;
+
+    // Event counts of one thread. Only the owner writes them; getStats()
+    // reads them through the thread registry.
+    struct ThreadCounters {
+        std::atomic<uint64_t> fast_path_hits[8] = {};
+        std::atomic<uint64_t> transfer_fetches[8] = {};
+        std::atomic<uint64_t> page_heap_refills[8] = {};
+        std::atomic<uint64_t> blocks_carved[8] = {};
+        std::atomic<uint64_t> scavenges[8] = {};
+        ThreadCounters* next_thread = nullptr; // Registry link
+        ThreadCounters* prev_thread = nullptr;
     };
 
+    // Uncut remainder of a fresh span. Blocks are taken from next one at a
+    // time, so memory is first written when it is allocated.
+    struct BumpRegion {
+        char* next = nullptr;
+        char* end = nullptr;
+    };
+
+    // Per-thread private cache for small allocations. Cache-line aligned so
+    // each group of four classes occupies exactly one line.
+    struct alignas(64) ThreadCache {
+        FreeList lists[8];
+        BumpRegion bump[8]; // Fresh spans, used when the matching list is empty
+        int node = -1; // NUMA node this thread draws from, resolved lazily
+        unsigned budget_events = 0; // Heap budget events raised under a lock, handled after it
+        unsigned flush_epoch = 0; // Last trim() flush request this thread has honoured
+        Span* large_spans[LARGE_THREAD_SLOTS] = {}; // Recently freed large spans, oldest first
+        size_t large_count = 0;
+        size_t large_bytes = 0;
+        unsigned lock_ticks = 0; // Lock acquisitions, drives profiler sampling
+        MyAllocator* owner = nullptr; // Instance that receives this cache at thread exit
+        ThreadCounters counters;
+        FrameStack frames[FRAME_CLASSES]; // Kept last: only coroutine-heavy threads touch them
+        BumpRegion frame_bump; // Uncut part of the newest frame span
+    };
+
+    static constexpr size_t getSizeClassIndex(size_t size) {
+        if (size > MAX_SMALL_ALLOC_SIZE) return 8; // Return invalid index, not -1
+        return SIZE_CLASS_TABLE.index[(size + 7) >> 3];
+    }
+
+    static constexpr size_t getClassSizeFromIndex(size_t index) {
+        if (index >= 8) return 0; // Safety check
+        return SIZE_CLASSES[index];
+    }
+
 private:
+    // Low bit of FreeBlockHeader::next: the block is still zero-filled.
+    static constexpr uintptr_t ZERO_TAG = 1;
+    // Top bit of BlockHeader::size: the block belongs to a long-lived pool.
+    static constexpr size_t LONG_LIVED_FLAG = (size_t)1 << 55;
+    // Largest size a header can record; larger requests fail with nullptr
+    // before any page count is computed, so the rounding cannot wrap.
+    static constexpr size_t MAX_LARGE_ALLOC_SIZE = LONG_LIVED_FLAG - 1;
+
+    static thread_local ThreadCache my_cache;
+
+    // Flushes the thread cache to its owner and retires the thread's counters
+    // when a thread exits; defined in the .cpp.
+    struct ThreadExitHook;
+    static thread_local ThreadExitHook thread_exit_hook;
+
+    static inline uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    // std::mutex that times one acquisition in LOCK_SAMPLE_INTERVAL per
+    // thread: wait from request to grant, hold from grant to release.
+    class ProfiledMutex {
+    public:
+        void lock() {
+            if (__builtin_expect(++my_cache.lock_ticks % LOCK_SAMPLE_INTERVAL != 0, 1)) {
+                mtx.lock();
+                return;
+            }
+            uint64_t start = readCycles();
+            bool contended = !mtx.try_lock();
+            if (contended) mtx.lock();
+            uint64_t granted = readCycles();
+            hold_start = granted;
+            samples.fetch_add(1, std::memory_order_relaxed);
+            if (contended) contended_samples.fetch_add(1, std::memory_order_relaxed);
+            wait_cycles.fetch_add(granted - start, std::memory_order_relaxed);
+        }
+        void unlock() {
+            if (__builtin_expect(hold_start != 0, 0)) {
+                hold_cycles.fetch_add(readCycles() - hold_start, std::memory_order_relaxed);
+                hold_start = 0;
+            }
+            mtx.unlock();
+        }
+        void addTo(LockStats& stats) const;
+    private:
+        std::mutex mtx;
+        uint64_t hold_start = 0; // Nonzero while a sampled acquisition holds the lock
+        std::atomic<uint64_t> samples{0};
+        std::atomic<uint64_t> contended_samples{0};
+        std::atomic<uint64_t> wait_cycles{0};
+        std::atomic<uint64_t> hold_cycles{0};
+    };
 
     // Shared buffer between ThreadCache and PageHeap.
     struct TransferCache {
-        std::mutex mtx;
+        mutable ProfiledMutex mtx; // Also taken by getStats()
         FreeBlockHeader* list = nullptr;
         int count = 0;
     };
 
+    // Large spans are cached by page count. Up to 8 pages each count has its
+    // own bucket; above that there are four buckets per power of two, up to
+    // LARGE_CACHE_MAX_PAGES (1 MB). Requests are rounded up to their bucket so
+    // any span in a bucket can serve any request mapped to it.
+    static constexpr size_t LARGE_BUCKETS = 28;
+    static constexpr size_t LARGE_CACHE_MAX_PAGES = 256;
+
+    // Recently freed large spans of one node. New spans are pushed at the
+    // head, so each bucket's tail is its oldest entry.
+    struct LargeCache {
+        ProfiledMutex mtx;
+        Span* heads[LARGE_BUCKETS] = {};
+        Span* tails[LARGE_BUCKETS] = {};
+        std::atomic<size_t> bytes{0}; // Written under mtx, read by getStats()
+        uint64_t last_trim_ms = 0;
+    };
+
     // --- The Three Tiers ---
 
     class PageHeap {
     public:
-        Span* allocateSpan(size_t num_pages);
+        Span* allocateSpan(size_t num_pages, int node);
         void deallocateSpan(Span* span);
         Span* lookupSpan(void* ptr);
     private:
-        std::mutex mtx;
-        std::unordered_map<size_t, Span*> page_map;
+        friend class MyAllocator; // Fork handlers and releaseFreeSpans take mtx directly
+        Span* lookupSpanLocked(void* ptr); // Caller holds mtx
+        ProfiledMutex mtx;
+        std::unordered_map<size_t, Span*, std::hash<size_t>, std::equal_to<size_t>,
+                           InternalAllocator<std::pair<const size_t, Span*>>> page_map;
+        std::atomic<size_t> span_count{0}; // Written under mtx, read by getStats()
+    };
+
+    // One partition per NUMA node: a page heap, its transfer caches, the
+    // long-lived pools and its large span cache.
+    struct NodeArena {
+        PageHeap page_heap;
+        TransferCache transfer_caches[8];
+        TransferCache long_lived[8]; // Lifetime::Long blocks, used without a thread cache
+        LargeCache large_cache;
     };
 
     // --- Private Members and Helpers ---
 
-    PageHeap page_heap;
-    TransferCache transfer_caches[8];
+    NodeArena arenas[MAX_NUMA_NODES];
+
+    // Frame slots that overflowed a thread's stack or outlived their thread.
+    struct FramePool {
+        ProfiledMutex mtx;
+        FreeBlockHeader* list = nullptr;
+        size_t count = 0;
+    };
+    FramePool frame_pools[FRAME_CLASSES];
+    std::atomic<size_t> frame_span_bytes{0};
+
+    // Movable objects. A handle indexes a table of entries that never move,
+    // so pin() reaches one without a lock. A live slot's header word holds
+    // its handle, which is how compact() finds the entry to update.
+    static constexpr uint32_t PIN_MOVING = 1u << 31; // Set in pins while compact() copies the object
+    static constexpr size_t HANDLE_CHUNK_ENTRIES = 4096;
+    static constexpr size_t HANDLE_CHUNKS = 1024; // Up to 4M live handles
+    struct MovableEntry {
+        std::atomic<uint32_t> pins; // Pin count, or PIN_MOVING
+        uint8_t class_index;        // 8 for a large block, which never moves
+        uint8_t node;               // Page heap that maps the slot
+        std::atomic<char*> ptr;     // The object; while unused, the next free handle
+    };
+    // Spans of one class. Partial spans have free slots, densest first after
+    // a compaction; full spans have none.
+    struct MovablePool {
+        ProfiledMutex mtx;
+        Span* partial = nullptr;
+        Span* full = nullptr;
+    };
+    MovablePool movable_pools[8];
+    ProfiledMutex handle_mtx;
+    std::atomic<MovableEntry*> handle_chunks[HANDLE_CHUNKS] = {};
+    uint32_t free_handles = 0; // Under handle_mtx
+    size_t handles_used = 0;   // Entries ever handed out, under handle_mtx
+    std::atomic<size_t> movable_span_bytes{0};
+    std::atomic<size_t> movable_live_bytes{0};
+    std::atomic<size_t> movable_moves{0};
+    std::atomic<size_t> compacted_bytes{0};
+    std::atomic<size_t> cross_node_frees{0};
+    std::atomic<size_t> small_span_bytes{0};
+    std::atomic<size_t> cache_flushes{0};
+    std::atomic<size_t> trimmed_bytes{0};
+    std::atomic<uint64_t> released_blocks[8] = {};
+
+    struct Tunables {
+        std::atomic<int> scavenge_threshold{128};
+        std::atomic<size_t> transfer_batch{DEFAULT_TRANSFER_BATCH};
+        std::atomic<size_t> refill_pages{1};
+        std::atomic<size_t> release_policy{RELEASE_ALL};
+        std::atomic<size_t> large_cache_bytes{32 << 20};
+        std::atomic<size_t> large_cache_decay_ms{1000};
+    };
+    Tunables tunables;
+
+    // Heap budget state
+    std::atomic<size_t> mapped_bytes{0};
+    std::atomic<size_t> soft_limit{0};
+    std::atomic<size_t> hard_limit{0};
+    std::atomic<bool> over_soft_limit{false};
+    std::atomic<uint64_t> soft_release_ms{0}; // Last flush and release above the soft limit
+    std::atomic<MemoryCallback> memory_callback{nullptr};
+    std::atomic<void*> memory_callback_arg{nullptr};
+    std::atomic<size_t> soft_limit_events{0};
+    std::atomic<size_t> hard_limit_failures{0};
+    MyAllocator* next_instance = nullptr; // Fork-handler registry link
+
+    static int numaNodeCount();
+    int currentNode();
+    void registerThread();
+    static void unregisterThread();
+    static inline void countEvent(std::atomic<uint64_t>& counter, uint64_t amount = 1);
 
-    static size_t getSizeClassIndex(size_t size);
-    static size_t getClassSizeFromIndex(size_t index);
+    // Fork safety: every allocator lock is held across fork().
+    static void prepareFork();
+    static void resumeAfterFork();
+    static void resumeAfterForkChild();
+    void lockAll();
+    void unlockAll();
 
-    void fetchFromTransferCache(size_t class_index);
-    void releaseToTransferCache(size_t class_index);
+    bool refillBumpRegion(size_t class_index);
+    void releaseBumpRegion(size_t class_index);
+    size_t fetchRange(size_t class_index, size_t count, FreeBlockHeader** out_head);
+    size_t fetchFromTransferCache(size_t class_index);
+    void releaseToTransferCache(size_t class_index, int count = INT_MAX);
+    void scavenge(size_t class_index);
+    void loadTunablesFromEnv();
+    size_t refillPages(size_t class_index) const;
+    size_t transferBatch(size_t class_index) const;
+#ifdef MYALLOC_TRACING
+    static void traceEvent(TraceOp op, size_t size, void* ptr);
+#endif
+    bool reserveBytes(size_t bytes);
+    void unreserveBytes(size_t bytes);
+    bool handleBudgetEvents(size_t requested_bytes, size_t keep_class = 8);
+    bool refillThreadCache(size_t class_index);
+    void flushThreadCache(size_t keep_class = 8);
+    inline void checkFlushRequest(size_t keep_class);
+    size_t releaseFreeSpans(NodeArena& arena, TransferCache& tc, size_t class_index, size_t& keep_bytes);
+    size_t releaseCachedSpans(size_t keep_bytes);
+    bool refillLongLivedPool(TransferCache& pool, size_t class_index, int node);
+    void* allocateLongLived(size_t class_index);
+    void deallocateLongLived(BlockHeader* header);
+    void* allocateFrameSlow(size_t frame_class);
+    void releaseFrameStack(size_t frame_class, size_t keep);
+    void releaseFrameBump();
+    inline MovableEntry& movableEntry(Handle handle) const;
+    inline void* pinAddress(Handle handle);
+    void* pinSlow(MovableEntry& entry);
+    Handle acquireHandle();
+    void releaseHandle(Handle handle);
+    bool refillMovablePool(MovablePool& pool, size_t class_index, int node);
+    bool moveObject(char* slot, Span* from, Span* to, size_t class_size);
+    size_t compactPool(size_t class_index);
+    size_t releaseEmptyMovableSpans(size_t class_index, size_t& keep_bytes);
+    size_t unmapMovableSpans(Span* spans);
+    static void linkSpan(Span*& list, Span* span);
+    static void unlinkSpan(Span*& list, Span* span);
+    static size_t largeBucketIndex(size_t num_pages);
+    static size_t largeBucketPages(size_t bucket);
+    Span* takeCachedSpan(size_t num_pages, int node);
+    bool cacheLargeSpan(Span* span);
+    void pushCentralSpan(Span* span);
+    size_t trimLargeCache(NodeArena& arena, size_t keep_bytes, uint64_t expire_before_ms);
+    void deallocateLarge(BlockHeader* header);
+    size_t largeSpanPages(size_t size) const;
+    void* allocateLarge(size_t size);
+    void* allocateSmallSlow(size_t index, bool* known_zero = nullptr);
+    inline void* allocateSmall(size_t index);
+    static inline void* popSmall(size_t index);
+#ifdef MYALLOC_HARDENED
+    void validateFree(void* ptr);
+    [[noreturn]] static void reportHeapCorruption(const char* what, const void* ptr);
+    static uintptr_t heapSecret();
+    static uintptr_t freeCanary(const void* header);
+#endif
+
+    // Free-list link helpers, defined below
+    static inline uintptr_t linkKey();
+    static inline uintptr_t decodeLink(FreeBlockHeader* block);
+    static inline void storeLink(FreeBlockHeader* block, uintptr_t raw);
+    static inline FreeBlockHeader* nextOf(FreeBlockHeader* block);
+    static inline bool isKnownZero(FreeBlockHeader* block);
+    static inline void pushBlock(FreeBlockHeader* block, FreeBlockHeader* next);
+    static inline void setNext(FreeBlockHeader* block, FreeBlockHeader* next);
+    static inline void prefetchBlock(FreeBlockHeader* block);
+    static constexpr size_t headerWord(size_t class_size, int node) {
+        return class_size | ((size_t)node << 56); // BlockHeader as one word (x86-64 ABI layout)
+    }
+    static inline void* initSmallBlock(FreeBlockHeader* block, size_t class_size, int node);
+    void releaseRemoteBlock(FreeBlockHeader* block, size_t class_index, int node);
 };
+
+// Defined in the header so every TU sees its constant initializer and
+// accesses it directly rather than through a TLS init wrapper.
+inline thread_local MyAllocator::ThreadCache MyAllocator::my_cache;
+
+// --- Free List Link Helpers ---
+// List heads are plain pointers; only the next field of a block carries the
+// tag, and the tag describes that block, so splices must preserve it. In
+// hardened builds the stored link is XOR-encoded with the heap secret.
+// What stored links are XORed with: the heap secret, or 0.
+inline uintptr_t MyAllocator::linkKey() {
+#ifdef MYALLOC_HARDENED
+    return heapSecret();
+#else
+    return 0;
+#endif
+}
+
+inline uintptr_t MyAllocator::decodeLink(FreeBlockHeader* block) {
+#ifdef MYALLOC_HARDENED
+    uintptr_t raw = (uintptr_t)block->next ^ heapSecret();
+    if (raw & 6) reportHeapCorruption("corrupted free list link", block);
+    return raw;
+#else
+    return (uintptr_t)block->next;
+#endif
+}
+
+inline void MyAllocator::storeLink(FreeBlockHeader* block, uintptr_t raw) {
+#ifdef MYALLOC_HARDENED
+    raw ^= heapSecret();
+#endif
+    block->next = (FreeBlockHeader*)raw;
+}
+
+inline MyAllocator::FreeBlockHeader* MyAllocator::nextOf(FreeBlockHeader* block) {
+    return (FreeBlockHeader*)(decodeLink(block) & ~ZERO_TAG);
+}
+
+inline bool MyAllocator::isKnownZero(FreeBlockHeader* block) {
+    return (decodeLink(block) & ZERO_TAG) != 0;
+}
+
+// Links a block that is being freed (and is therefore no longer zero).
+inline void MyAllocator::pushBlock(FreeBlockHeader* block, FreeBlockHeader* next) {
+    storeLink(block, (uintptr_t)next);
+}
+
+inline void MyAllocator::setNext(FreeBlockHeader* block, FreeBlockHeader* next) {
+    storeLink(block, (decodeLink(block) & ZERO_TAG) | (uintptr_t)next);
+}
+
+// Pulls the next free block's line in while the current one is handed out,
+// so the following pop's link load hits the cache.
+inline void MyAllocator::prefetchBlock(FreeBlockHeader* block) {
+#ifndef MYALLOC_NO_PREFETCH
+    __builtin_prefetch(block, 1, 3);
+#else
+    (void)block;
+#endif
+}
+
+// Turns a block popped from a free list into a live allocation.
+inline void* MyAllocator::initSmallBlock(FreeBlockHeader* block, size_t class_size, int node) {
+    BlockHeader* header = (BlockHeader*)block;
+    // Compose both bitfields in a register (size in the low 56 bits on x86-64
+    // ABIs) so the header costs one store instead of a read-modify-write.
+    size_t word = headerWord(class_size, node);
+    __builtin_memcpy(header, &word, sizeof(word));
+#ifdef MYALLOC_HARDENED
+    *(uintptr_t*)(header + 1) = 0; // Clear the double-free canary
+#endif
+    return (void*)(header + 1);
+}
+
+// --- Inline Fast Path ---
+// Single-writer increment: a plain load and store, but race-free for readers.
+inline void MyAllocator::countEvent(std::atomic<uint64_t>& counter, uint64_t amount) {
+    counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+inline void* MyAllocator::allocate_frame(size_t size) {
+    size_t frame_class = (size - 1) / FRAME_GRANULE;
+    if (frame_class >= FRAME_CLASSES) return allocate(size);
+    FrameStack& stack = my_cache.frames[frame_class];
+    FreeBlockHeader* slot = stack.head;
+    if (__builtin_expect(slot != nullptr, 1)) {
+        stack.head = nextOf(slot);
+        stack.depth--;
+    } else {
+        slot = (FreeBlockHeader*)allocateFrameSlow(frame_class);
+    }
+#ifdef MYALLOC_TRACING
+    traceEvent(TRACE_ALLOC, size, slot);
+#endif
+    return slot;
+}
+
+inline void MyAllocator::deallocate_frame(void* ptr, size_t size) {
+    size_t frame_class = (size - 1) / FRAME_GRANULE;
+    if (ptr == nullptr || frame_class >= FRAME_CLASSES) return deallocate(ptr);
+#ifdef MYALLOC_TRACING
+    traceEvent(TRACE_FREE, 0, ptr);
+#endif
+    // A thread that only frees frames must still hand its stacks back at exit.
+    if (__builtin_expect(my_cache.node < 0, 0)) currentNode();
+    FrameStack& stack = my_cache.frames[frame_class];
+    FreeBlockHeader* slot = (FreeBlockHeader*)ptr;
+    pushBlock(slot, stack.head);
+    stack.head = slot;
+    if (__builtin_expect(++stack.depth > FRAME_STACK_LIMIT, 0)) {
+        releaseFrameStack(frame_class, FRAME_STACK_LIMIT / 2);
+    }
+}
+
+inline MyAllocator::MovableEntry& MyAllocator::movableEntry(Handle handle) const {
+    size_t index = handle.id - 1;
+    return handle_chunks[index / HANDLE_CHUNK_ENTRIES].load(std::memory_order_acquire)[index % HANDLE_CHUNK_ENTRIES];
+}
+
+// The acquire CAS pairs with the release that ends a move, so the address
+// read after it is the object's current one.
+inline void* MyAllocator::pinAddress(Handle handle) {
+    MovableEntry& entry = movableEntry(handle);
+    uint32_t pins = entry.pins.load(std::memory_order_relaxed);
+    if (__builtin_expect((pins & PIN_MOVING) != 0, 0) ||
+        !entry.pins.compare_exchange_weak(pins, pins + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+        return pinSlow(entry);
+    }
+    return entry.ptr.load(std::memory_order_relaxed);
+}
+
+inline void MyAllocator::unpin(Handle handle) {
+    movableEntry(handle).pins.fetch_sub(1, std::memory_order_release);
+}
+
+inline void* MyAllocator::allocateSmall(size_t index) {
+    if (__builtin_expect(my_cache.lists[index].head == nullptr, 0)) return allocateSmallSlow(index);
+    countEvent(my_cache.counters.fast_path_hits[index]);
+    return popSmall(index);
+}
+
+// Pops the head of a non-empty thread cache list.
+inline void* MyAllocator::popSmall(size_t index) {
+    FreeList& list = my_cache.lists[index];
+    FreeBlockHeader* block = list.head;
+    FreeBlockHeader* next = nextOf(block);
+    list.head = next;
+    list.length--;
+    prefetchBlock(next);
+
+    return initSmallBlock(block, SIZE_CLASSES[index], my_cache.node);
+}
@@ -1,15 +1,52 @@
 // benchmark.cpp
 
 #include "allocator.h"
+#include "span_init.h"
+#include "thread_heap.h"
 #include <iostream>
+#include <string>
 #include <vector>
 #include <thread>
 #include <chrono>
 #include <random>
 #include <numeric>
+#include <atomic>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <x86intrin.h>
 
 MyAllocator g_allocator;
 
+// --- Result Recording ---
+// Every headline number is also kept here so `benchmark --json <file>` can
+// write them out for comparing builds (see the `bench` CMake target).
+struct BenchResult {
+    std::string name;
+    double value;
+    const char* unit;
+};
+static std::vector<BenchResult> bench_results;
+
+void record_result(const std::string& name, double value, const char* unit) {
+    bench_results.push_back({name, value, unit});
+}
+
+bool write_json_results(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == nullptr) return false;
+    fprintf(file, "{\n  \"hardened\": %s,\n  \"prefetch\": %s,\n  \"results\": [\n",
+            MyAllocator::HARDENED ? "true" : "false", MyAllocator::PREFETCH ? "true" : "false");
+    for (size_t i = 0; i < bench_results.size(); ++i) {
+        const BenchResult& r = bench_results[i];
+        fprintf(file, "    {\"name\": \"%s\", \"value\": %.3f, \"unit\": \"%s\"}%s\n",
+                r.name.c_str(), r.value, r.unit, i + 1 < bench_results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+    return fclose(file) == 0;
+}
+
 // Recursion guard
 static thread_local bool in_allocator = false;
 
@@ -82,8 +119,583 @@ void worker_thread_workload(int thread_id) {
     }
 }
 
-int main() {
+// --- Zeroed Allocation Benchmark ---
+// Each round allocates a burst of zeroed blocks and frees them again, so the
+// small classes are served partly from fresh (known-zero) and partly from
+// recycled blocks, as in a real program.
+const int ZEROED_ROUNDS = 20;
+const int ZEROED_BURST = 1000;
+
+void* my_allocate_zeroed(size_t size) {
+    return g_allocator.allocate_zeroed(1, size);
+}
+
+void my_deallocate(void* ptr) {
+    g_allocator.deallocate(ptr);
+}
+
+template <typename AllocFn, typename FreeFn>
+double time_zeroed_allocations(size_t size, AllocFn alloc_fn, FreeFn free_fn) {
+    std::vector<void*> ptrs(ZEROED_BURST);
+    auto start_time = std::chrono::high_resolution_clock::now();
+    for (int round = 0; round < ZEROED_ROUNDS; ++round) {
+        for (void*& p : ptrs) p = alloc_fn(size);
+        for (void* p : ptrs) free_fn(p);
+    }
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::nano> elapsed = end_time - start_time;
+    return elapsed.count() / (ZEROED_ROUNDS * ZEROED_BURST);
+}
+
+void run_zeroed_benchmark() {
+    const std::vector<size_t> sizes = {64, 512, 4096, 64 * 1024, 1024 * 1024};
+    for (size_t size : sizes) {
+        double mine = time_zeroed_allocations(size,
+            my_allocate_zeroed, my_deallocate);
+        double libc = time_zeroed_allocations(size,
+            [](size_t n) { return std::calloc(1, n); },
+            [](void* p) { std::free(p); });
+        std::cout << "Size: " << size
+                  << "\tallocate_zeroed: " << mine << " ns/op"
+                  << "\tcalloc: " << libc << " ns/op" << std::endl;
+        record_result("zeroed/" + std::to_string(size) + "/allocate_zeroed", mine, "ns/op");
+        record_result("zeroed/" + std::to_string(size) + "/calloc", libc, "ns/op");
+    }
+}
+
+// --- Batch Allocation Benchmark ---
+// Compares allocate_batch/deallocate_batch against the equivalent loop of
+// single calls, reporting the cost per object for each batch size.
+const size_t BATCH_OBJECT_SIZE = 48;
+const size_t BATCH_TOTAL_OBJECTS = 1 << 20;
+
+void run_batch_benchmark() {
+    const std::vector<size_t> batch_sizes = {16, 64, 256, 1024, 4096};
+    std::vector<void*> ptrs(batch_sizes.back());
+
+    for (size_t batch : batch_sizes) {
+        size_t rounds = BATCH_TOTAL_OBJECTS / batch;
+
+        auto start_time = std::chrono::high_resolution_clock::now();
+        for (size_t r = 0; r < rounds; ++r) {
+            for (size_t i = 0; i < batch; ++i) ptrs[i] = g_allocator.allocate(BATCH_OBJECT_SIZE);
+            for (size_t i = 0; i < batch; ++i) g_allocator.deallocate(ptrs[i]);
+        }
+        auto mid_time = std::chrono::high_resolution_clock::now();
+        for (size_t r = 0; r < rounds; ++r) {
+            g_allocator.allocate_batch(BATCH_OBJECT_SIZE, batch, ptrs.data());
+            g_allocator.deallocate_batch(ptrs.data(), batch);
+        }
+        auto end_time = std::chrono::high_resolution_clock::now();
+
+        std::chrono::duration<double, std::nano> single = mid_time - start_time;
+        std::chrono::duration<double, std::nano> batched = end_time - mid_time;
+        std::cout << "Batch: " << batch
+                  << "\tSingle calls: " << single.count() / (rounds * batch) << " ns/object"
+                  << "\tBatch API: " << batched.count() / (rounds * batch) << " ns/object"
+                  << std::endl;
+        record_result("batch/" + std::to_string(batch) + "/single", single.count() / (rounds * batch), "ns/object");
+        record_result("batch/" + std::to_string(batch) + "/batch_api", batched.count() / (rounds * batch), "ns/object");
+    }
+}
+
+// --- Large Object Churn Benchmark ---
+// Each thread keeps a small set of 4-256 KB buffers (HTTP body sized) and
+// keeps replacing a random one, touching each new buffer once. Runs with the
+// large span cache on and off, and against glibc.
+const int LARGE_CHURN_THREADS = 4;
+const int LARGE_CHURN_LIVE = 16;
+const int LARGE_CHURN_OPS = 20000;
+
+template <typename AllocFn, typename FreeFn>
+double time_large_churn(AllocFn alloc_fn, FreeFn free_fn) {
+    auto worker = [&](int id) {
+        std::mt19937 gen(id);
+        std::uniform_int_distribution<size_t> size_dist(4 * 1024, 256 * 1024);
+        std::uniform_int_distribution<int> slot_dist(0, LARGE_CHURN_LIVE - 1);
+        std::vector<void*> live(LARGE_CHURN_LIVE, nullptr);
+        for (int i = 0; i < LARGE_CHURN_OPS; ++i) {
+            void*& slot = live[slot_dist(gen)];
+            if (slot) free_fn(slot);
+            slot = alloc_fn(size_dist(gen));
+            if (slot) *(volatile char*)slot = 1;
+        }
+        for (void* p : live) if (p) free_fn(p);
+    };
+
+    std::vector<std::thread> threads;
+    auto start_time = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < LARGE_CHURN_THREADS; ++i) threads.emplace_back(worker, i);
+    for (auto& t : threads) t.join();
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::nano> elapsed = end_time - start_time;
+    return elapsed.count() / (LARGE_CHURN_THREADS * LARGE_CHURN_OPS);
+}
+
+void run_large_churn_benchmark() {
+    auto my_alloc = [](size_t n) { return g_allocator.allocate(n); };
+    auto my_free = [](void* p) { g_allocator.deallocate(p); };
+
+    size_t cache_bytes = g_allocator.getTunable(MyAllocator::Tunable::LargeCacheBytes);
+    g_allocator.setTunable(MyAllocator::Tunable::LargeCacheBytes, 0);
+    double uncached = time_large_churn(my_alloc, my_free);
+    g_allocator.setTunable(MyAllocator::Tunable::LargeCacheBytes, cache_bytes ? cache_bytes : 32 << 20);
+    double cached = time_large_churn(my_alloc, my_free);
+    g_allocator.setTunable(MyAllocator::Tunable::LargeCacheBytes, cache_bytes);
+    double libc = time_large_churn([](size_t n) { return std::malloc(n); },
+                                   [](void* p) { std::free(p); });
+
+    std::cout << "Large cache off: " << uncached << " ns/op"
+              << "\tLarge cache on: " << cached << " ns/op"
+              << "\tglibc: " << libc << " ns/op" << std::endl;
+    record_result("large_churn/cache_off", uncached, "ns/op");
+    record_result("large_churn/cache_on", cached, "ns/op");
+    record_result("large_churn/glibc", libc, "ns/op");
+}
+
+// --- Heap Trim After a Spike ---
+// Threads allocate a burst of mixed small blocks, free them in random order
+// and exit, leaving the memory in the transfer caches. trim(0) should hand
+// nearly all of it back; RSS is read from /proc/self/statm.
+const int TRIM_SPIKE_THREADS = 4;
+const size_t TRIM_SPIKE_BYTES = 64 << 20; // Across all threads
+
+static size_t resident_bytes() {
+    size_t pages = 0, resident = 0;
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (f) {
+        if (fscanf(f, "%zu %zu", &pages, &resident) != 2) resident = 0;
+        fclose(f);
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+void run_trim_benchmark() {
+    auto worker = [](int id) {
+        std::mt19937 gen(id);
+        std::uniform_int_distribution<size_t> size_dist(16, MAX_SMALL_ALLOC_SIZE);
+        std::vector<void*> ptrs;
+        for (size_t bytes = 0; bytes < TRIM_SPIKE_BYTES / TRIM_SPIKE_THREADS;) {
+            size_t size = size_dist(gen);
+            void* p = g_allocator.allocate(size);
+            memset(p, 1, size);
+            ptrs.push_back(p);
+            bytes += size;
+        }
+        std::shuffle(ptrs.begin(), ptrs.end(), gen);
+        for (void* p : ptrs) g_allocator.deallocate(p);
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < TRIM_SPIKE_THREADS; ++i) threads.emplace_back(worker, i);
+    for (auto& t : threads) t.join();
+
+    size_t rss_before = resident_bytes();
+    size_t mapped_before = g_allocator.getStats().mapped_bytes;
+    auto start_time = std::chrono::high_resolution_clock::now();
+    size_t released = g_allocator.trim(0);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start_time;
+    size_t rss_after = resident_bytes();
+
+    std::cout << "Mapped before: " << (mapped_before >> 20) << " MB"
+              << "\tReleased: " << (released >> 20) << " MB in " << elapsed.count() << " ms"
+              << "\tRSS: " << (rss_before >> 20) << " MB -> " << (rss_after >> 20) << " MB" << std::endl;
+    record_result("trim/released", (double)(released >> 20), "MB");
+    record_result("trim/time", elapsed.count(), "ms");
+    record_result("trim/rss_after", (double)(rss_after >> 20), "MB");
+}
+
+// --- Lifetime-Segregated Spans ---
+// Each round allocates a burst of short-lived blocks, keeps every
+// LIFETIME_KEEP_EVERY-th one as a long-lived survivor and frees the rest, so
+// survivors accumulate while the churn comes and goes. Without hints the
+// survivors are scattered over spans that are otherwise free and pin all of
+// them; with Lifetime::Long they share their own spans and trim(0) can
+// release the rest. Ratios are small-span bytes over live survivor bytes.
+const int LIFETIME_ROUNDS = 16;
+const int LIFETIME_BURST = 32768;
+const int LIFETIME_KEEP_EVERY = 64;
+
+static void lifetime_phase(bool hinted) {
+    g_allocator.trim(0);
+    size_t baseline = g_allocator.getStats().small_span_bytes;
+    std::vector<void*> survivors;
+    size_t live_bytes = 0, peak_bytes = 0;
+
+    std::thread worker([&] {
+        std::mt19937 gen(7);
+        std::uniform_int_distribution<size_t> size_dist(16, 256);
+        std::vector<void*> burst;
+        for (int round = 0; round < LIFETIME_ROUNDS; ++round) {
+            for (int i = 0; i < LIFETIME_BURST; ++i) {
+                size_t size = size_dist(gen);
+                if (i % LIFETIME_KEEP_EVERY == 0) {
+                    survivors.push_back(hinted ? g_allocator.allocate(size, MyAllocator::Lifetime::Long)
+                                               : g_allocator.allocate(size));
+                    live_bytes += size;
+                } else {
+                    burst.push_back(g_allocator.allocate(size));
+                }
+            }
+            peak_bytes = std::max(peak_bytes, g_allocator.getStats().small_span_bytes - baseline);
+            for (void* p : burst) g_allocator.deallocate(p);
+            burst.clear();
+        }
+    });
+    worker.join();
+
+    g_allocator.trim(0);
+    size_t resident = g_allocator.getStats().small_span_bytes - baseline;
+    for (void* p : survivors) g_allocator.deallocate(p);
+
+    double peak_ratio = (double)peak_bytes / live_bytes;
+    double resident_ratio = (double)resident / live_bytes;
+    const char* name = hinted ? "hinted" : "unhinted";
+    std::cout << (hinted ? "Lifetime hints:    " : "No lifetime hints: ")
+              << "live " << (live_bytes >> 10) << " KB\tpeak " << (peak_bytes >> 10)
+              << " KB (" << peak_ratio << "x)\tafter trim " << (resident >> 10) << " KB ("
+              << resident_ratio << "x)" << std::endl;
+    record_result(std::string("lifetime/") + name + "_peak_to_live", peak_ratio, "ratio");
+    record_result(std::string("lifetime/") + name + "_resident_to_live", resident_ratio, "ratio");
+}
+
+void run_lifetime_benchmark() {
+    lifetime_phase(false);
+    lifetime_phase(true);
+}
+
+// --- Movable Object Compaction ---
+// A cache fills with COMPACT_OBJECTS objects of 32-512 bytes, then evicts all
+// but 1 in COMPACT_KEEP_EVERY at random, leaving its spans ~5% live. Plain
+// blocks stay where they are, so trim(0) can release almost nothing; movable
+// objects are compacted on a background thread while the main thread keeps
+// reading survivors through pin(), then trim(0) runs as well. Reported as
+// RSS and span bytes over live bytes, after eviction and after release.
+const int COMPACT_OBJECTS = 400000;
+const int COMPACT_KEEP_EVERY = 20;
+
+static void compaction_phase(bool movable) {
+    g_allocator.trim(0);
+    size_t rss_baseline = resident_bytes();
+    auto span_bytes = [movable] {
+        MyAllocator::Stats stats = g_allocator.getStats();
+        return movable ? stats.movable_span_bytes : stats.small_span_bytes;
+    };
+    size_t span_baseline = span_bytes();
+
+    std::mt19937 gen(11);
+    std::uniform_int_distribution<size_t> size_dist(32, 512);
+    std::vector<void*> blocks;
+    std::vector<MyAllocator::Handle> handles;
+    std::vector<size_t> sizes;
+    std::thread filler([&] {
+        for (int i = 0; i < COMPACT_OBJECTS; ++i) {
+            size_t size = size_dist(gen);
+            sizes.push_back(size);
+            if (movable) {
+                MyAllocator::Handle h = g_allocator.allocate_movable(size);
+                memset(g_allocator.pin(h), (int)size, size);
+                g_allocator.unpin(h);
+                handles.push_back(h);
+            } else {
+                void* p = g_allocator.allocate(size);
+                memset(p, (int)size, size);
+                blocks.push_back(p);
+            }
+        }
+        // Evict in random order, keeping every COMPACT_KEEP_EVERY-th object.
+        std::vector<int> order(COMPACT_OBJECTS);
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), gen);
+        for (int i = 0; i < COMPACT_OBJECTS; ++i) {
+            if (i % COMPACT_KEEP_EVERY == 0) continue;
+            if (movable) {
+                g_allocator.deallocate_movable(handles[order[i]]);
+                handles[order[i]] = MyAllocator::Handle{};
+            } else {
+                g_allocator.deallocate(blocks[order[i]]);
+                blocks[order[i]] = nullptr;
+            }
+        }
+    });
+    filler.join();
+
+    std::vector<int> survivors;
+    size_t live_bytes = 0;
+    for (int i = 0; i < COMPACT_OBJECTS; ++i) {
+        if (movable ? (bool)handles[i] : blocks[i] != nullptr) {
+            survivors.push_back(i);
+            live_bytes += sizes[i];
+        }
+    }
+    size_t spans_before = span_bytes() - span_baseline;
+    size_t rss_before = resident_bytes() - rss_baseline;
+
+    double compact_ms = 0;
+    size_t reads = 0, corrupt = 0;
+    if (movable) {
+        std::atomic<bool> done{false};
+        std::thread compactor([&] {
+            auto start_time = std::chrono::high_resolution_clock::now();
+            g_allocator.compact();
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start_time;
+            compact_ms = elapsed.count();
+            done = true;
+        });
+        while (!done.load()) {
+            int i = survivors[reads++ % survivors.size()];
+            unsigned char* p = g_allocator.pin<unsigned char>(handles[i]);
+            if (p[0] != (unsigned char)sizes[i] || p[sizes[i] - 1] != (unsigned char)sizes[i]) ++corrupt;
+            g_allocator.unpin(handles[i]);
+        }
+        compactor.join();
+    }
+    g_allocator.trim(0);
+    size_t spans_after = span_bytes() - span_baseline;
+    size_t rss_after = resident_bytes() - rss_baseline;
+
+    for (int i : survivors) {
+        if (movable) g_allocator.deallocate_movable(handles[i]);
+        else g_allocator.deallocate(blocks[i]);
+    }
+
+    const char* name = movable ? "movable" : "plain";
+    std::cout << (movable ? "Movable + compact: " : "Plain + trim:      ")
+              << "live " << (live_bytes >> 10) << " KB\tspans " << (spans_before >> 10) << " KB -> "
+              << (spans_after >> 10) << " KB (" << (double)spans_after / live_bytes << "x live)\tRSS "
+              << (rss_before >> 20) << " MB -> " << (rss_after >> 20) << " MB";
+    if (movable) {
+        std::cout << "\tcompact " << compact_ms << " ms, " << reads << " pinned reads meanwhile"
+                  << (corrupt ? " (CORRUPT)" : "");
+    }
+    std::cout << std::endl;
+    record_result(std::string("compaction/") + name + "_span_to_live", (double)spans_after / live_bytes, "ratio");
+    record_result(std::string("compaction/") + name + "_rss_after", (double)(rss_after >> 20), "MB");
+    if (movable) record_result("compaction/compact_time", compact_ms, "ms");
+}
+
+void run_compaction_benchmark() {
+    compaction_phase(false);
+    compaction_phase(true);
+}
+
+// --- Fast Path Microbenchmark ---
+// Frees a thread-cache-sized working set in shuffled order, evicts it from
+// the cache, then times allocating the whole set back and freeing it again
+// with rdtsc: one allocate/free pair per block. The allocations pop from the
+// cold list, the case the pop-ahead prefetch targets; build with
+// -DMYALLOC_NO_PREFETCH to compare.
+const int FAST_PATH_WORKING_SET = 120; // Stays below the scavenge threshold
+const int FAST_PATH_ROUNDS = 2000;
+
+void run_fast_path_benchmark() {
+    std::vector<void*> ptrs(FAST_PATH_WORKING_SET);
+    std::vector<char> evict(8 << 20);
+    std::mt19937 gen(42);
+    unsigned long long cycles = 0;
+
+    for (void*& p : ptrs) p = g_allocator.allocate(64);
+    for (int round = 0; round < FAST_PATH_ROUNDS; ++round) {
+        std::shuffle(ptrs.begin(), ptrs.end(), gen);
+        for (void* p : ptrs) g_allocator.deallocate(p);
+        for (size_t i = 0; i < evict.size(); i += 64) evict[i]++;
+
+        unsigned long long start = __rdtsc();
+        for (void*& p : ptrs) p = g_allocator.allocate(64);
+        for (void* p : ptrs) g_allocator.deallocate(p);
+        cycles += __rdtsc() - start;
+        for (void*& p : ptrs) p = g_allocator.allocate(64);
+    }
+    for (void* p : ptrs) g_allocator.deallocate(p);
+
+    double cycles_per_pair = (double)cycles / (FAST_PATH_ROUNDS * FAST_PATH_WORKING_SET);
+    std::cout << "Prefetch: " << (MyAllocator::PREFETCH ? "on" : "off")
+              << "\tCycles per allocate/free pair: " << cycles_per_pair << std::endl;
+    record_result("fast_path/cold_list", cycles_per_pair, "cycles/pair");
+}
+
+// --- Per-Thread Heaps ---
+// Shared-nothing churn: every thread replaces random blocks of its own
+// working set, once through the shared MyAllocator and once through a
+// ThreadHeap of its own, at 1 to 64 threads. Reported as total Mops/s.
+const int THREAD_HEAP_SLOTS = 256;
+const int THREAD_HEAP_OPS = 100000; // Per thread
+
+template <typename AllocFn, typename FreeFn>
+void thread_heap_churn(int seed, AllocFn alloc_fn, FreeFn free_fn) {
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<size_t> size_dist(16, 512);
+    void* slots[THREAD_HEAP_SLOTS] = {};
+    for (int op = 0; op < THREAD_HEAP_OPS; ++op) {
+        void*& slot = slots[gen() % THREAD_HEAP_SLOTS];
+        free_fn(slot);
+        slot = alloc_fn(size_dist(gen));
+    }
+    for (void* p : slots) free_fn(p);
+}
+
+template <typename Body>
+double time_threads(int threads, Body body) {
+    auto start_time = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) workers.emplace_back(body, t);
+    for (auto& w : workers) w.join();
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::high_resolution_clock::now() - start_time;
+    return (double)threads * THREAD_HEAP_OPS / elapsed.count();
+}
+
+void run_thread_heap_benchmark() {
+    for (int threads : {1, 2, 4, 8, 16, 32, 64}) {
+        double shared = time_threads(threads, [](int t) {
+            thread_heap_churn(t, [](size_t size) { return g_allocator.allocate(size); },
+                              [](void* p) { g_allocator.deallocate(p); });
+        });
+        double owned = time_threads(threads, [](int t) {
+            ThreadHeap* heap = make_thread_heap();
+            thread_heap_churn(t, [heap](size_t size) { return heap->allocate(size); },
+                              [heap](void* p) { heap->deallocate(p); });
+            delete heap;
+        });
+        std::cout << threads << " threads:\tMyAllocator " << shared << " Mops/s"
+                  << "\tThreadHeap " << owned << " Mops/s" << std::endl;
+        record_result("thread_heap/" + std::to_string(threads) + "/shared", shared, "Mops/s");
+        record_result("thread_heap/" + std::to_string(threads) + "/owned", owned, "Mops/s");
+    }
+}
+
+// --- Span Refill Kernels ---
+// Cycles per block to thread a span into a free list and to export it as an
+// allocate_batch result, at each SIMD level the CPU supports. The span is
+// pre-faulted and reused, so this is the store cost alone, without the
+// page faults of a real refill.
+const size_t REFILL_SPAN_BYTES = 8 * 4096;
+const int REFILL_ROUNDS = 4000;
+
+void run_span_init_benchmark() {
+    std::vector<char> span(REFILL_SPAN_BYTES + 64);
+    char* start = (char*)(((uintptr_t)span.data() + 63) & ~(uintptr_t)63);
+    std::vector<void*> out(REFILL_SPAN_BYTES / 16);
+    SpanInit::Level detected = SpanInit::detectedLevel();
+    std::cout << "Detected: " << SpanInit::levelName(detected) << std::endl;
+
+    for (size_t index = 0; index < 8; ++index) {
+        size_t block_size = SIZE_CLASSES[index] + sizeof(size_t);
+        size_t count = REFILL_SPAN_BYTES / block_size;
+        std::cout << "Class " << SIZE_CLASSES[index] << "\t";
+        for (int level = 0; level <= (int)detected; ++level) {
+            SpanInit::setLevel((SpanInit::Level)level);
+            const char* name = SpanInit::levelName((SpanInit::Level)level);
+            unsigned long long start_cycles = __rdtsc();
+            for (int round = 0; round < REFILL_ROUNDS; ++round) {
+                SpanInit::threadBlocks(start, count, block_size, 0, 1, 0);
+            }
+            double thread_cycles = (double)(__rdtsc() - start_cycles) / (REFILL_ROUNDS * count);
+            start_cycles = __rdtsc();
+            for (int round = 0; round < REFILL_ROUNDS; ++round) {
+                SpanInit::exportBlocks(start, count, block_size, SIZE_CLASSES[index], out.data());
+            }
+            double export_cycles = (double)(__rdtsc() - start_cycles) / (REFILL_ROUNDS * count);
+            std::cout << name << " " << thread_cycles << " / " << export_cycles << "\t";
+            std::string key = "span_init/" + std::to_string(SIZE_CLASSES[index]) + "/" + name;
+            record_result(key + "/thread", thread_cycles, "cycles/block");
+            record_result(key + "/export", export_cycles, "cycles/block");
+        }
+        std::cout << std::endl;
+    }
+    SpanInit::setLevel(detected);
+}
+
+// --- Constant-Size Allocation Benchmark ---
+// A class-specific operator new resolves the size class at compile time via
+// allocate<sizeof(T)>(); PlainNode goes through the global operator new.
+struct PlainNode {
+    PlainNode* left;
+    PlainNode* right;
+    long key;
+};
+
+struct FixedNode {
+    FixedNode* left;
+    FixedNode* right;
+    long key;
+
+    static void* operator new(size_t) { return g_allocator.allocate<sizeof(FixedNode)>(); }
+    static void operator delete(void* ptr) noexcept { g_allocator.deallocate(ptr); }
+};
+
+const int CONSTANT_SIZE_OBJECTS = 100;
+const int CONSTANT_SIZE_ROUNDS = 20000;
+
+template <typename Node>
+double time_node_churn() {
+    std::vector<Node*> nodes(CONSTANT_SIZE_OBJECTS);
+    auto start_time = std::chrono::high_resolution_clock::now();
+    for (int round = 0; round < CONSTANT_SIZE_ROUNDS; ++round) {
+        for (Node*& n : nodes) n = new Node();
+        for (Node* n : nodes) delete n;
+    }
+    auto end_time = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::nano> elapsed = end_time - start_time;
+    return elapsed.count() / (CONSTANT_SIZE_ROUNDS * CONSTANT_SIZE_OBJECTS);
+}
+
+void run_constant_size_benchmark() {
+    double plain = time_node_churn<PlainNode>();
+    double fixed = time_node_churn<FixedNode>();
+    std::cout << "Global operator new: " << plain << " ns/object"
+              << "\tallocate<sizeof(T)>: " << fixed << " ns/object" << std::endl;
+    record_result("constant_size/operator_new", plain, "ns/object");
+    record_result("constant_size/allocate_n", fixed, "ns/object");
+}
+
+// --- Allocator Statistics ---
+void print_lock_stats(const char* name, const MyAllocator::LockStats& lock) {
+    std::cout << name << "\tsamples: " << lock.samples
+              << "\tcontended: " << lock.contended;
+    if (lock.samples) {
+        std::cout << "\tavg wait: " << lock.wait_cycles / lock.samples << " cycles"
+                  << "\tavg hold: " << lock.hold_cycles / lock.samples << " cycles";
+    }
+    std::cout << std::endl;
+}
+
+void print_allocator_stats(const MyAllocator::Stats& stats) {
+    std::cout << "\nSize class counters (fast-path hits / transfer fetches / page heap refills):" << std::endl;
+    for (size_t i = 0; i < 8; ++i) {
+        const MyAllocator::ClassStats& c = stats.classes[i];
+        size_t span_bytes = SPAN_LAYOUT.pages[i] * PAGE_BYTES;
+        size_t used = SPAN_LAYOUT.objects[i] * (SIZE_CLASSES[i] + sizeof(MyAllocator::BlockHeader));
+        std::cout << "Class " << SIZE_CLASSES[i] << "\t" << c.fast_path_hits
+                  << " / " << c.transfer_fetches << " / " << c.page_heap_refills
+                  << "\tspan: " << SPAN_LAYOUT.pages[i] << " pages x " << SPAN_LAYOUT.objects[i]
+                  << " blocks, " << 100.0 * (span_bytes - used) / span_bytes << "% tail waste"
+                  << ", batch " << SPAN_LAYOUT.batch[i] << std::endl;
+    }
+
+    std::cout << "\nLock profile (1 in " << MyAllocator::LOCK_SAMPLE_INTERVAL << " acquisitions sampled):" << std::endl;
+    for (size_t i = 0; i < 8; ++i) {
+        std::string name = "TransferCache " + std::to_string(SIZE_CLASSES[i]);
+        print_lock_stats(name.c_str(), stats.transfer_cache_locks[i]);
+    }
+    print_lock_stats("PageHeap", stats.page_heap_lock);
+    print_lock_stats("LargeCache", stats.large_cache_lock);
+}
+
+int main(int argc, char** argv) {
+    const char* json_path = nullptr;
+    for (int i = 1; i + 1 < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) json_path = argv[i + 1];
+    }
+
     std::cout << "--- Allocator Benchmark (Using Custom Allocator) ---" << std::endl;
+    std::cout << "Hardened mode: " << (MyAllocator::HARDENED ? "on" : "off") << std::endl;
+    std::cout << "Tunables: scavenge_threshold=" << g_allocator.getTunable(MyAllocator::Tunable::ScavengeThreshold)
+              << " transfer_batch=" << g_allocator.getTunable(MyAllocator::Tunable::TransferBatch)
+              << " refill_pages=" << g_allocator.getTunable(MyAllocator::Tunable::RefillPages)
+              << " release_policy="
+              << (g_allocator.getTunable(MyAllocator::Tunable::ReleasePolicy) == MyAllocator::RELEASE_BATCH ? "batch" : "all")
+              << " large_cache_bytes=" << g_allocator.getTunable(MyAllocator::Tunable::LargeCacheBytes)
+              << " large_cache_decay_ms=" << g_allocator.getTunable(MyAllocator::Tunable::LargeCacheDecayMs)
+              << std::endl;
     
     // Basic test first
     std::cout << "Running basic test..." << std::endl;
@@ -95,6 +707,7 @@ int main() {
         std::cout << "Basic test failed!" << std::endl;
         return 1;
     }
+
     
     // Benchmark
     const std::vector<int> thread_counts = {1, 2, 4, 8};
@@ -121,6 +734,56 @@ int main() {
                   << "\tOperations: " << (n_threads * NUM_ALLOCATIONS_PER_THREAD * 2)
                   << "\tOps/sec: " << (n_threads * NUM_ALLOCATIONS_PER_THREAD * 2 * 1000.0 / elapsed.count())
                   << std::endl;
+        record_result("threads/" + std::to_string(n_threads),
+                      n_threads * NUM_ALLOCATIONS_PER_THREAD * 2 * 1000.0 / elapsed.count(), "ops/sec");
+    }
+
+    std::cout << "\nFast path (cold free list)..." << std::endl;
+    run_fast_path_benchmark();
+
+    std::cout << "\nSpan refill kernels (cycles per block, thread / export)..." << std::endl;
+    run_span_init_benchmark();
+
+    std::cout << "\nConstant-size allocation (" << sizeof(FixedNode) << " byte nodes)..." << std::endl;
+    run_constant_size_benchmark();
+
+    std::cout << "\nZeroed allocation (allocate_zeroed vs calloc)..." << std::endl;
+    run_zeroed_benchmark();
+
+    std::cout << "\nBatch allocation (" << BATCH_OBJECT_SIZE << " byte objects)..." << std::endl;
+    run_batch_benchmark();
+
+    std::cout << "\nLarge object churn (" << LARGE_CHURN_THREADS << " threads, 4-256 KB)..." << std::endl;
+    run_large_churn_benchmark();
+
+    std::cout << "\nHeap trim after a " << (TRIM_SPIKE_BYTES >> 20) << " MB spike..." << std::endl;
+    run_trim_benchmark();
+
+    std::cout << "\nSurvivors among short-lived churn (" << LIFETIME_ROUNDS << " rounds, 1 in "
+              << LIFETIME_KEEP_EVERY << " kept)..." << std::endl;
+    run_lifetime_benchmark();
+
+    std::cout << "\nCache eviction to 1 in " << COMPACT_KEEP_EVERY << " objects, plain vs movable..." << std::endl;
+    run_compaction_benchmark();
+
+    std::cout << "\nShared-nothing churn, shared heap vs per-thread heaps..." << std::endl;
+    run_thread_heap_benchmark();
+
+    MyAllocator::Stats stats = g_allocator.getStats();
+    std::cout << "\nNUMA nodes: " << stats.numa_nodes
+              << "\tCross-node frees: " << stats.cross_node_frees << std::endl;
+    std::cout << "Mapped bytes: " << stats.mapped_bytes
+              << "\tSoft limit events: " << stats.soft_limit_events
+              << "\tHard limit failures: " << stats.hard_limit_failures
+              << "\tLarge cache bytes: " << stats.large_cache_bytes << std::endl;
+    print_allocator_stats(stats);
+
+    if (json_path != nullptr) {
+        if (!write_json_results(json_path)) {
+            std::cout << "Could not write results to " << json_path << std::endl;
+            return 1;
+        }
+        std::cout << "\nResults written to " << json_path << std::endl;
     }
 
     std::cout << "\nBenchmark completed successfully!" << std::endl;
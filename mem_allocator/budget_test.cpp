@@ -0,0 +1,124 @@
+// budget_test.cpp
+//
+// Heap budget test for MyAllocator. Sets a soft and a hard limit above what
+// is already mapped, then fills the heap with small blocks until an
+// allocation fails: the callback must see the soft limit crossed first and
+// the hard limit last, and the heap must never map more than the hard limit.
+// The blocks are then freed and, with the hard limit lifted, a refill of
+// another size class above the soft limit must hand their spans back to the
+// OS. Finally the heap keeps growing above the soft limit, where every new
+// span raises the event but the cache flush behind it must stay rate limited.
+//
+// Usage: budget_test [soft-mb] [hard-mb]
+
+#include "allocator.h"
+#include "test_util.h"
+#include <cstdio>
+#include <chrono>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+MyAllocator g_allocator;
+
+const size_t FILL_SIZE = 64;
+const size_t PROBE_SIZE = 512; // A class the fill leaves untouched
+const size_t SUSTAIN_SIZE = 200;
+const size_t SUSTAIN_BLOCKS = 100000;
+
+static size_t soft_events = 0;
+static size_t hard_events = 0;
+
+static bool onMemoryEvent(MyAllocator::MemoryEvent event, size_t requested_bytes, void*) {
+    if (event == MyAllocator::MemoryEvent::SoftLimit) ++soft_events;
+    else ++hard_events;
+    CHECK(requested_bytes != 0, "memory event without a request size");
+    return false;
+}
+
+int main(int argc, char** argv) {
+    size_t soft_mb = argc > 1 ? strtoull(argv[1], nullptr, 10) : 4;
+    size_t hard_mb = argc > 2 ? strtoull(argv[2], nullptr, 10) : 8;
+    printf("Budget test: soft=%zu MB hard=%zu MB above the baseline\n", soft_mb, hard_mb);
+
+    size_t base = g_allocator.getStats().mapped_bytes;
+    size_t soft = base + (soft_mb << 20);
+    size_t hard = base + (hard_mb << 20);
+    g_allocator.setMemoryCallback(onMemoryEvent, nullptr);
+    g_allocator.setMemoryLimits(soft, hard);
+
+    // Fill until the hard limit refuses an allocation. The bound only stops
+    // a broken limit from exhausting the machine.
+    std::vector<void*> blocks;
+    size_t max_blocks = 4 * (hard_mb << 20) / FILL_SIZE;
+    size_t soft_events_at_soft = 0;
+    while (blocks.size() < max_blocks) {
+        void* p = g_allocator.allocate(FILL_SIZE);
+        if (p == nullptr) break;
+        blocks.push_back(p);
+        if (soft_events_at_soft == 0 && g_allocator.getStats().mapped_bytes > soft) {
+            soft_events_at_soft = soft_events;
+        }
+    }
+
+    MyAllocator::Stats full = g_allocator.getStats();
+    CHECK(blocks.size() < max_blocks, "no allocation failed after %zu blocks", blocks.size());
+    CHECK(soft_events_at_soft == 1, "%zu soft-limit callbacks when the heap crossed the soft limit",
+          soft_events_at_soft);
+    CHECK(soft_events == 1, "%zu soft-limit callbacks for one crossing", soft_events);
+    CHECK(full.soft_limit_events == 1, "soft_limit_events is %zu", full.soft_limit_events);
+    CHECK(hard_events == 1, "%zu hard-limit callbacks for one failed allocation", hard_events);
+    CHECK(full.hard_limit_failures == 1, "hard_limit_failures is %zu", full.hard_limit_failures);
+    CHECK(full.mapped_bytes <= hard, "%zu bytes mapped over a %zu byte hard limit", full.mapped_bytes, hard);
+    CHECK(full.mapped_bytes > soft, "only %zu bytes mapped at the hard limit", full.mapped_bytes);
+
+    // Freed blocks stay mapped in the caches until the next budget event.
+    for (void* p : blocks) g_allocator.deallocate(p);
+    size_t freed = g_allocator.getStats().mapped_bytes;
+    CHECK(freed > soft, "freeing dropped the heap to %zu bytes before any budget event", freed);
+
+    // Lift the hard limit so the refill below raises only a soft-limit event,
+    // and let the rate limit on releases above the soft limit lapse.
+    g_allocator.setMemoryLimits(soft, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2 * MyAllocator::SOFT_LIMIT_RELEASE_MS));
+    void* probe = g_allocator.allocate(PROBE_SIZE);
+    CHECK(probe != nullptr, "allocate(%zu) failed after the heap was freed", PROBE_SIZE);
+    size_t shrunk = g_allocator.getStats().mapped_bytes;
+    CHECK(shrunk <= soft, "heap still maps %zu bytes over a %zu byte soft limit (%zu before the refill)",
+          shrunk, soft, freed);
+    g_allocator.deallocate(probe);
+
+    // Start just under the soft limit with nothing left to release and keep
+    // mapping spans above it. One crossing means one callback, and the
+    // flushes must not follow every refill.
+    g_allocator.trim(0);
+    g_allocator.setMemoryLimits(g_allocator.getStats().mapped_bytes + (1 << 20), 0);
+    size_t soft_events_before = soft_events;
+    size_t flushes_before = g_allocator.getStats().cache_flushes;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<void*> sustained;
+    sustained.reserve(SUSTAIN_BLOCKS);
+    for (size_t i = 0; i < SUSTAIN_BLOCKS; ++i) {
+        void* p = g_allocator.allocate(SUSTAIN_SIZE);
+        CHECK(p != nullptr, "allocate(%zu) failed above the soft limit", SUSTAIN_SIZE);
+        if (p == nullptr) break;
+        sustained.push_back(p);
+    }
+    size_t elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    size_t flushes = g_allocator.getStats().cache_flushes - flushes_before;
+    size_t allowed = 2 + elapsed_ms / MyAllocator::SOFT_LIMIT_RELEASE_MS;
+    CHECK(soft_events == soft_events_before + 1, "%zu soft-limit callbacks for one sustained crossing",
+          soft_events - soft_events_before);
+    CHECK(flushes <= allowed, "%zu cache flushes in %zu ms above the soft limit (at most %zu)",
+          flushes, elapsed_ms, allowed);
+    for (void* p : sustained) g_allocator.deallocate(p);
+
+    if (failures != 0) {
+        printf("Budget test FAILED: %d check(s)\n", failures.load());
+        return 1;
+    }
+    printf("Budget test passed (%zu blocks, %zu MB -> %zu MB mapped)\n", blocks.size(),
+           (full.mapped_bytes - base) >> 20, shrunk > base ? (shrunk - base) >> 20 : 0);
+    return 0;
+}
@@ -0,0 +1,103 @@
+// fork_test.cpp
+//
+// Fork-safety regression test for MyAllocator. Background threads hammer
+// every size class, the large path, the long-lived pools, coroutine frames
+// and movable objects (and one of them trims and compacts) while the main
+// thread forks repeatedly. Each child must be able to allocate at once on
+// every path; a child stuck on a lock inherited from the parent is killed by
+// its alarm and fails the test.
+//
+// Usage: fork_test [forks] [threads]
+
+#include "allocator.h"
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+MyAllocator g_allocator;
+
+const int LIVE_BLOCKS = 256; // Blocks a hammer holds before freeing them all
+const unsigned CHILD_TIMEOUT_S = 5;
+
+static void hammer(std::atomic<bool>* stop, int id) {
+    std::mt19937 gen(id);
+    std::vector<void*> live;
+    std::vector<MyAllocator::Handle> movables;
+    unsigned round = 0;
+    while (!stop->load(std::memory_order_relaxed)) {
+        size_t size = 1 + gen() % 8192;
+        switch (gen() % 4) {
+        case 0: live.push_back(g_allocator.allocate(size, MyAllocator::Lifetime::Long)); break;
+        case 1: movables.push_back(g_allocator.allocate_movable(size)); break;
+        case 2: g_allocator.deallocate_frame(g_allocator.allocate_frame(size), size); break;
+        default: live.push_back(g_allocator.allocate(size)); break;
+        }
+        if (live.size() + movables.size() > LIVE_BLOCKS) {
+            for (void* p : live) g_allocator.deallocate(p);
+            for (MyAllocator::Handle h : movables) g_allocator.deallocate_movable(h);
+            live.clear();
+            movables.clear();
+            if (id == 0 && ++round % 8 == 0) {
+                g_allocator.compact();
+                g_allocator.trim(1 << 20);
+            }
+        }
+    }
+    for (void* p : live) g_allocator.deallocate(p);
+    for (MyAllocator::Handle h : movables) g_allocator.deallocate_movable(h);
+}
+
+// Runs in the child: any lock left held across fork() hangs here.
+static void childWork() {
+    alarm(CHILD_TIMEOUT_S);
+    for (int j = 0; j < 1000; ++j) {
+        size_t size = (j * 37) % 8192 + 1;
+        char* p = (char*)g_allocator.allocate(size);
+        if (p == nullptr) _exit(1);
+        p[0] = 1;
+        g_allocator.deallocate(p);
+        g_allocator.deallocate(g_allocator.allocate(size, MyAllocator::Lifetime::Long));
+        g_allocator.deallocate_frame(g_allocator.allocate_frame(size), size);
+        g_allocator.deallocate_movable(g_allocator.allocate_movable(size));
+    }
+    g_allocator.compact();
+    g_allocator.trim(0);
+    g_allocator.getStats();
+    _exit(0);
+}
+
+int main(int argc, char** argv) {
+    int forks = argc > 1 ? atoi(argv[1]) : 50;
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+    printf("Fork test: forks=%d threads=%d\n", forks, threads);
+
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> hammers;
+    for (int t = 0; t < threads; ++t) hammers.emplace_back(hammer, &stop, t);
+
+    int failures = 0;
+    for (int i = 0; i < forks && failures == 0; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) childWork();
+        int status = 0;
+        if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "FAIL: fork %d: child %s\n", i,
+                    WIFSIGNALED(status) && WTERMSIG(status) == SIGALRM ? "deadlocked" : "failed");
+            ++failures;
+        }
+    }
+
+    stop = true;
+    for (auto& t : hammers) t.join();
+    if (failures != 0) {
+        printf("Fork test FAILED\n");
+        return 1;
+    }
+    printf("Fork test passed\n");
+    return 0;
+}
@@ -0,0 +1,63 @@
+// instance_test.cpp
+//
+// Two MyAllocator instances used from one thread. Each instance only frees
+// its own blocks, but the thread cache is shared by every instance, so one
+// instance's free blocks end up in the other's transfer caches. trim() on
+// either must cope with blocks it has no span for, and both instances must
+// keep handing out intact blocks afterwards.
+//
+// Usage: instance_test [blocks]
+
+#include "allocator.h"
+#include "test_util.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+MyAllocator g_first;
+MyAllocator g_second;
+
+const size_t SIZES[] = {24, 64, 200, 1000};
+
+// Allocates and frees count pattern-filled blocks of every size in SIZES,
+// checking each block before it is freed.
+static void churn(MyAllocator& allocator, const char* name, size_t count, uint64_t id_base) {
+    std::vector<Block> blocks;
+    blocks.reserve(count * (sizeof(SIZES) / sizeof(SIZES[0])));
+    for (size_t size : SIZES) {
+        for (size_t i = 0; i < count; ++i) {
+            Block b{(unsigned char*)allocator.allocate(size), size, id_base + blocks.size()};
+            CHECK(b.ptr != nullptr, "%s: allocate(%zu) failed", name, size);
+            if (b.ptr == nullptr) return;
+            fillBlock(b);
+            blocks.push_back(b);
+        }
+    }
+    for (const Block& b : blocks) {
+        checkBlock(b);
+        allocator.deallocate(b.ptr);
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 20000;
+    printf("Instance test: %zu blocks per size class\n", count);
+
+    churn(g_first, "first", count, 1ULL << 40);
+    churn(g_second, "second", count, 2ULL << 40);
+    g_second.trim(0);
+    g_first.trim(0);
+
+    // Both heaps must still work, in either order, and trim again.
+    churn(g_second, "second", count, 3ULL << 40);
+    churn(g_first, "first", count, 4ULL << 40);
+    g_first.trim(0);
+    g_second.trim(0);
+
+    if (failures != 0) {
+        printf("Instance test FAILED: %d check(s)\n", failures.load());
+        return 1;
+    }
+    printf("Instance test passed\n");
+    return 0;
+}
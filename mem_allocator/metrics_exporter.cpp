@@ -0,0 +1,104 @@
+// metrics_exporter.cpp
+//
+// Minimal OpenMetrics endpoint for trying MyAllocator::renderMetrics with a
+// Prometheus scraper or curl. A background thread churns allocations so the
+// numbers move; the main thread answers every HTTP request on a loopback
+// port with the current metrics.
+//
+// Usage: metrics_exporter [port]   (default 9464)
+//        metrics_exporter --once   (print the metrics once and exit)
+//
+//   curl http://127.0.0.1:9464/metrics
+
+#include "allocator.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+
+MyAllocator g_allocator;
+
+static char metrics[64 << 10]; // Static, so a scrape allocates nothing
+
+static void churn(std::atomic<bool>* stop) {
+    std::mt19937 gen(1);
+    void* slots[512] = {};
+    while (!stop->load(std::memory_order_relaxed)) {
+        void*& slot = slots[gen() % 512];
+        g_allocator.deallocate(slot);
+        slot = g_allocator.allocate(gen() % 8 == 0 ? 1 + gen() % (64 << 10) : 1 + gen() % 1024);
+        if (gen() % 100000 == 0) g_allocator.trim(1 << 20);
+    }
+    for (void* p : slots) g_allocator.deallocate(p);
+}
+
+static void writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, data, length);
+        if (n <= 0) return;
+        data += n;
+        length -= n;
+    }
+}
+
+static void serve(int client) {
+    char request[1024];
+    ssize_t n = read(client, request, sizeof(request) - 1); // Any request gets the metrics
+    if (n <= 0) return;
+
+    size_t length = g_allocator.renderMetrics(metrics, sizeof(metrics));
+    if (length >= sizeof(metrics)) length = sizeof(metrics) - 1;
+    char header[256];
+    int header_length = snprintf(header, sizeof(header),
+                                 "HTTP/1.1 200 OK\r\n"
+                                 "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                                 "Content-Length: %zu\r\n"
+                                 "Connection: close\r\n\r\n",
+                                 length);
+    writeAll(client, header, header_length);
+    writeAll(client, metrics, length);
+}
+
+int main(int argc, char** argv) {
+    std::atomic<bool> stop{false};
+    std::thread worker(churn, &stop);
+
+    if (argc > 1 && strcmp(argv[1], "--once") == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        size_t length = g_allocator.renderMetrics(metrics, sizeof(metrics));
+        fwrite(metrics, 1, length < sizeof(metrics) ? length : sizeof(metrics) - 1, stdout);
+        stop = true;
+        worker.join();
+        return length < sizeof(metrics) ? 0 : 1;
+    }
+
+    int port = argc > 1 ? atoi(argv[1]) : 9464;
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // Local testing only
+    if (listener < 0 || bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 16) != 0) {
+        perror("metrics_exporter: cannot listen");
+        stop = true;
+        worker.join();
+        return 1;
+    }
+    printf("Serving allocator metrics on http://127.0.0.1:%d/metrics\n", port);
+    fflush(stdout);
+
+    while (true) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) continue;
+        serve(client);
+        close(client);
+    }
+}
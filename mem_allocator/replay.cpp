@@ -0,0 +1,166 @@
+// replay.cpp
+//
+// Re-executes an allocation trace recorded by a -DMYALLOC_TRACING build
+// (MYALLOC_TRACE=<file>) against MyAllocator or glibc malloc, and reports
+// throughput, peak RSS and fragmentation (peak heap bytes / peak live bytes).
+//
+// Usage: replay <trace-file> [myalloc|glibc]
+//
+// Records from all threads are merged by timestamp and replayed on a single
+// thread, so the result measures allocator work, not contention.
+
+#include "allocator.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+MyAllocator g_allocator;
+
+// Heap size is sampled every this many operations to keep the probe cheap.
+const size_t HEAP_SAMPLE_INTERVAL = 4096;
+
+struct Backend {
+    const char* name;
+    void* (*alloc)(size_t size);
+    void* (*alloc_zeroed)(size_t size);
+    void (*free)(void* ptr);
+    size_t (*heap_bytes)();
+};
+
+static size_t glibc_heap_bytes() {
+    struct mallinfo2 info = mallinfo2();
+    return info.arena + info.hblkhd;
+}
+
+static const Backend BACKENDS[] = {
+    {"myalloc",
+     [](size_t size) { return g_allocator.allocate(size); },
+     [](size_t size) { return g_allocator.allocate_zeroed(1, size); },
+     [](void* ptr) { g_allocator.deallocate(ptr); },
+     [] { return g_allocator.getStats().mapped_bytes; }},
+    {"glibc",
+     [](size_t size) { return std::malloc(size); },
+     [](size_t size) { return std::calloc(1, size); },
+     [](void* ptr) { std::free(ptr); },
+     glibc_heap_bytes},
+};
+
+// Maps the trace privately so the records stay out of the heap being measured.
+// Returns the records (sorted in place by timestamp) or nullptr.
+static MyAllocator::TraceRecord* load_trace(const char* path, size_t& count) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat st;
+    const size_t header = sizeof(MyAllocator::TRACE_MAGIC);
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < header) {
+        close(fd);
+        return nullptr;
+    }
+    void* map = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return nullptr;
+    if (memcmp(map, MyAllocator::TRACE_MAGIC, header) != 0) {
+        munmap(map, st.st_size);
+        return nullptr;
+    }
+
+    auto* records = reinterpret_cast<MyAllocator::TraceRecord*>((char*)map + header);
+    count = (st.st_size - header) / sizeof(MyAllocator::TraceRecord);
+    std::stable_sort(records, records + count,
+                     [](const MyAllocator::TraceRecord& a, const MyAllocator::TraceRecord& b) {
+                         return a.timestamp_ns < b.timestamp_ns;
+                     });
+    return records;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <trace-file> [myalloc|glibc]\n", argv[0]);
+        return 1;
+    }
+    const char* backend_name = argc > 2 ? argv[2] : "myalloc";
+    const Backend* backend = nullptr;
+    for (const Backend& b : BACKENDS) {
+        if (strcmp(b.name, backend_name) == 0) backend = &b;
+    }
+    if (backend == nullptr) {
+        fprintf(stderr, "Unknown allocator '%s' (expected myalloc or glibc)\n", backend_name);
+        return 1;
+    }
+
+    size_t record_count = 0;
+    MyAllocator::TraceRecord* records = load_trace(argv[1], record_count);
+    if (records == nullptr) {
+        fprintf(stderr, "Cannot read trace file %s\n", argv[1]);
+        return 1;
+    }
+
+    // Trace ids map to (pointer, size) in this run. Ids whose allocation
+    // predates the trace are skipped when freed.
+    struct LiveBlock {
+        void* ptr;
+        size_t size;
+    };
+    std::unordered_map<uint64_t, LiveBlock> live;
+    live.reserve(record_count / 2);
+
+    // The id map lives in the glibc heap, so heap growth is measured from this
+    // baseline (glibc figures still include the map's own nodes).
+    size_t baseline_heap_bytes = backend->heap_bytes();
+    size_t live_bytes = 0, peak_live_bytes = 0, peak_heap_bytes = baseline_heap_bytes;
+    size_t ops = 0, failed = 0, unmatched_frees = 0;
+
+    auto start_time = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < record_count; i++) {
+        const MyAllocator::TraceRecord& record = records[i];
+        if (record.op == MyAllocator::TRACE_FREE) {
+            auto it = live.find(record.ptr_id);
+            if (it == live.end()) {
+                unmatched_frees++;
+                continue;
+            }
+            backend->free(it->second.ptr);
+            live_bytes -= it->second.size;
+            live.erase(it);
+        } else {
+            void* ptr = record.op == MyAllocator::TRACE_ALLOC_ZEROED ? backend->alloc_zeroed(record.size)
+                                                                     : backend->alloc(record.size);
+            if (ptr == nullptr) {
+                failed++;
+                continue;
+            }
+            *(volatile char*)ptr = 1; // Touch the block as the program would
+            live[record.ptr_id] = {ptr, record.size};
+            live_bytes += record.size;
+            peak_live_bytes = std::max(peak_live_bytes, live_bytes);
+        }
+        if (++ops % HEAP_SAMPLE_INTERVAL == 0) {
+            peak_heap_bytes = std::max(peak_heap_bytes, backend->heap_bytes());
+        }
+    }
+    auto end_time = std::chrono::steady_clock::now();
+    peak_heap_bytes = std::max(peak_heap_bytes, backend->heap_bytes());
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    std::chrono::duration<double> elapsed = end_time - start_time;
+
+    printf("Allocator: %s\n", backend->name);
+    printf("Records: %zu\tReplayed ops: %zu\tFailed allocs: %zu\tUnmatched frees: %zu\n",
+           record_count, ops, failed, unmatched_frees);
+    printf("Time: %.3f s\tThroughput: %.0f ops/sec\n", elapsed.count(), ops / elapsed.count());
+    printf("Peak RSS: %ld KB\n", usage.ru_maxrss);
+    printf("Peak live: %zu bytes\tPeak heap: %zu bytes\tFragmentation: %.3f\n",
+           peak_live_bytes, peak_heap_bytes - baseline_heap_bytes,
+           peak_live_bytes ? (double)(peak_heap_bytes - baseline_heap_bytes) / peak_live_bytes : 0.0);
+    return 0;
+}
@@ -0,0 +1,433 @@
+// shared_heap.cpp
+
+#include "shared_heap.h"
+#include <sys/mman.h> // For memfd_create, mmap, madvise
+#include <sys/stat.h> // For fstat
+#include <fcntl.h>    // For open, F_ADD_SEALS, OFD locks
+#include <unistd.h>   // For ftruncate, pread, close
+#include <cerrno>     // For EOWNERDEAD
+#include <cstring>    // For memcpy, memcmp
+#include <new>        // For std::nothrow
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000 // Linux 4.17; older kernels treat it as a hint
+#endif
+
+// --- Creation and Attachment ---
+SharedHeap::SharedHeap(char* base, size_t mapped_bytes, int fd)
+    : base(base), mapped_bytes(mapped_bytes), data_offset(0), heap_fd(fd) {}
+
+SharedHeap::~SharedHeap() {
+    // The last process out of a file heap (the only one that can take the
+    // write lock) flushes it and records the clean close.
+    if (persistent && lockFile(heap_fd, F_WRLCK, false)) {
+        msync(base, mapped_bytes, MS_SYNC);
+        header()->clean = 1;
+        msync(base, PAGE_BYTES, MS_SYNC);
+    }
+    munmap(base, mapped_bytes);
+    close(heap_fd);
+}
+
+void SharedHeap::initMutex(pthread_mutex_t* mtx) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(mtx, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+void SharedHeap::initLocks() {
+    Header* h = header();
+    initMutex(&h->heap_lock);
+    for (ClassState& cls : h->classes) initMutex(&cls.lock);
+}
+
+size_t SharedHeap::metadataBytes(size_t num_pages) {
+    size_t bytes = sizeof(Header) + num_pages * sizeof(PageDesc);
+    return (bytes + PAGE_BYTES - 1) & ~(PAGE_BYTES - 1);
+}
+
+// Sizes an empty descriptor to `capacity`, maps it and writes a fresh heap
+// into it. The caller still owns `fd` on failure.
+SharedHeap* SharedHeap::format(int fd, size_t capacity, void* base) {
+    capacity &= ~(PAGE_BYTES - 1);
+    size_t num_pages = capacity / (PAGE_BYTES + sizeof(PageDesc));
+    while (num_pages > 0 && metadataBytes(num_pages) + (num_pages << PAGE_SHIFT) > capacity) {
+        --num_pages;
+    }
+    if (num_pages == 0 || num_pages >= NO_PAGE || ftruncate(fd, capacity) != 0) return nullptr;
+
+    int flags = MAP_SHARED | (base ? MAP_FIXED_NOREPLACE : 0);
+    void* mem = mmap(base, capacity, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (mem == MAP_FAILED || (base && mem != base)) {
+        if (mem != MAP_FAILED) munmap(mem, capacity);
+        return nullptr;
+    }
+    SharedHeap* heap = new (std::nothrow) SharedHeap((char*)mem, capacity, fd);
+    if (!heap) {
+        munmap(mem, capacity);
+        return nullptr;
+    }
+    heap->data_offset = metadataBytes(num_pages);
+
+    // The new file starts zeroed, so only the non-zero fields are set.
+    Header* h = heap->header();
+    h->version = VERSION;
+    h->page_bytes = PAGE_BYTES;
+    h->header_bytes = sizeof(Header);
+    h->capacity = capacity;
+    h->base_address = (uintptr_t)mem;
+    h->data_offset = heap->data_offset;
+    h->num_pages = (uint32_t)num_pages;
+    heap->initLocks();
+    for (size_t i = 0; i < FREE_LISTS; ++i) h->free_spans[i] = NO_PAGE;
+    heap->pushFreeSpan(0, (uint32_t)num_pages);
+    memcpy(h->magic, MAGIC, sizeof(MAGIC)); // Last, so a valid magic means a complete heap
+    return heap;
+}
+
+// Maps a formatted heap, at `base` if given and otherwise preferably at the
+// creator's address so raw pointers stay valid; elsewhere only offsets
+// carry over. The caller still owns `fd` on failure.
+SharedHeap* SharedHeap::mapExisting(int fd, void* base) {
+    Header probe;
+    struct stat st;
+    if (pread(fd, &probe, sizeof(probe), 0) != (ssize_t)sizeof(probe) ||
+        memcmp(probe.magic, MAGIC, sizeof(MAGIC)) != 0 || probe.version != VERSION ||
+        probe.page_bytes != PAGE_BYTES || probe.header_bytes != sizeof(Header) ||
+        fstat(fd, &st) != 0 || (uint64_t)st.st_size < probe.capacity) {
+        return nullptr;
+    }
+
+    size_t capacity = probe.capacity;
+    void* want = base ? base : (void*)probe.base_address;
+    void* mem = mmap(want, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    if (mem == MAP_FAILED && base == nullptr) {
+        mem = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (mem == MAP_FAILED) return nullptr;
+
+    SharedHeap* heap = new (std::nothrow) SharedHeap((char*)mem, capacity, fd);
+    if (!heap) {
+        munmap(mem, capacity);
+        return nullptr;
+    }
+    heap->data_offset = probe.data_offset;
+    return heap;
+}
+
+SharedHeap* SharedHeap::create(const char* name, size_t capacity, void* base) {
+    // Sealed at its size, so no process can shrink the file under another's
+    // mapping. No MFD_CLOEXEC: exec'd workers inherit the descriptor.
+    int fd = memfd_create(name, MFD_ALLOW_SEALING);
+    if (fd < 0) return nullptr;
+    SharedHeap* heap = format(fd, capacity, base);
+    if (!heap) {
+        close(fd);
+        return nullptr;
+    }
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0) {
+        delete heap;
+        return nullptr;
+    }
+    return heap;
+}
+
+SharedHeap* SharedHeap::attach(int fd) {
+    int own_fd = dup(fd);
+    if (own_fd < 0) return nullptr;
+    SharedHeap* heap = mapExisting(own_fd, nullptr);
+    if (!heap) close(own_fd);
+    return heap;
+}
+
+// --- Persistent Heaps ---
+// Every process holding a file heap open keeps a shared OFD lock on it. The
+// first one in gets the write lock instead: it formats a new file, or takes
+// ownership of an existing one (fresh locks, span lists rebuilt if the last
+// session crashed), and then converts to a read lock. Conversions of OFD
+// locks are atomic, so no second opener can slip in between.
+bool SharedHeap::lockFile(int fd, short type, bool wait) {
+    struct flock lock = {};
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    return fcntl(fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &lock) == 0;
+}
+
+SharedHeap* SharedHeap::open(const char* path, size_t capacity, void* base) {
+    int fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return nullptr;
+
+    SharedHeap* heap = nullptr;
+    struct stat st;
+    if (lockFile(fd, F_WRLCK, false)) {
+        if (fstat(fd, &st) == 0 && st.st_size == 0) {
+            heap = format(fd, capacity, base);
+        } else if ((heap = mapExisting(fd, base)) != nullptr) {
+            // Nobody else has the file open, so locks left held by a dead
+            // process are simply reset.
+            Header* h = heap->header();
+            heap->initLocks();
+            heap->clean_open = h->clean != 0;
+            if (!heap->clean_open && !heap->rebuildSpanLists()) {
+                delete heap; // Also closes fd, dropping the lock
+                return nullptr;
+            }
+        }
+        if (heap) heap->header()->clean = 0;
+        lockFile(fd, F_RDLCK, true);
+    } else if (lockFile(fd, F_RDLCK, true)) {
+        heap = mapExisting(fd, base); // The first opener already recovered it
+        // If the last user closed while this open waited for the read lock,
+        // its close left the file marked clean. Nobody can take the write
+        // lock while this one is held, so the store cannot race a close.
+        if (heap) heap->header()->clean = 0;
+    }
+
+    if (!heap) {
+        close(fd);
+        return nullptr;
+    }
+    heap->persistent = true;
+    return heap;
+}
+
+void SharedHeap::setRoot(void* ptr) {
+    __atomic_store_n(&header()->root_offset, toOffset(ptr), __ATOMIC_RELEASE);
+}
+
+void* SharedHeap::root() const {
+    return fromOffset(__atomic_load_n(&header()->root_offset, __ATOMIC_ACQUIRE));
+}
+
+bool SharedHeap::sync() {
+    return msync(base, mapped_bytes, MS_SYNC) == 0;
+}
+
+// Walks the page descriptors span by span after a crash: every span's first
+// descriptor is current, so the walk visits each span once. Free-span lists
+// and page counts are rebuilt from it (merging adjacent free spans), which
+// undoes a span operation torn halfway. Returns false if the descriptors
+// themselves do not chain up.
+bool SharedHeap::rebuildSpanLists() {
+    Header* h = header();
+    PageDesc* desc = pages();
+    for (size_t i = 0; i < FREE_LISTS; ++i) h->free_spans[i] = NO_PAGE;
+    h->small_pages = 0;
+    h->large_pages = 0;
+
+    uint32_t free_start = NO_PAGE;
+    for (uint32_t page = 0; page < h->num_pages;) {
+        uint32_t num_pages = desc[page].span_pages;
+        uint8_t kind = desc[page].kind;
+        if (num_pages == 0 || num_pages > h->num_pages - page || kind > PAGE_LARGE) return false;
+        if (kind == PAGE_FREE) {
+            if (free_start == NO_PAGE) free_start = page;
+        } else {
+            if (free_start != NO_PAGE) pushFreeSpan(free_start, page - free_start);
+            free_start = NO_PAGE;
+            markSpan(page, num_pages, kind, desc[page].size_class);
+            (kind == PAGE_SMALL ? h->small_pages : h->large_pages) += num_pages;
+        }
+        page += num_pages;
+    }
+    if (free_start != NO_PAGE) pushFreeSpan(free_start, h->num_pages - free_start);
+    return true;
+}
+
+bool SharedHeap::isFixedBase() const {
+    return header()->base_address == (uintptr_t)base;
+}
+
+// A lock whose owner died is taken over as is: the free list or span the
+// owner was editing may lose its blocks, but the other processes go on.
+SharedHeap::SharedLock::SharedLock(Header* header, pthread_mutex_t* mtx) : mtx(mtx) {
+    if (pthread_mutex_lock(mtx) == EOWNERDEAD) {
+        pthread_mutex_consistent(mtx);
+        header->lock_recoveries.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// --- Span Management ---
+// Free spans of up to MAX_SPAN_PAGES pages sit on a list per exact length,
+// so any non-empty list at or above the request fits; longer spans share
+// the last list and are searched first-fit. Neighbouring free spans are
+// merged when a large block is freed.
+size_t SharedHeap::freeListIndex(size_t num_pages) {
+    return (num_pages < FREE_LISTS ? num_pages : FREE_LISTS) - 1;
+}
+
+void SharedHeap::markSpan(uint32_t start, uint32_t num_pages, uint8_t kind, uint8_t size_class) {
+    PageDesc* desc = pages();
+    uint32_t last = start + num_pages - 1;
+    auto mark = [&](uint32_t page) {
+        desc[page].span_start = start;
+        desc[page].span_pages = num_pages;
+        desc[page].kind = kind;
+        desc[page].size_class = size_class;
+    };
+    mark(start);
+    mark(last);
+    if (kind == PAGE_SMALL) {
+        for (uint32_t page = start + 1; page < last; ++page) mark(page);
+    }
+}
+
+void SharedHeap::pushFreeSpan(uint32_t start, uint32_t num_pages) {
+    markSpan(start, num_pages, PAGE_FREE);
+    PageDesc* desc = pages();
+    uint32_t& head = header()->free_spans[freeListIndex(num_pages)];
+    desc[start].prev_free = NO_PAGE;
+    desc[start].next_free = head;
+    if (head != NO_PAGE) desc[head].prev_free = start;
+    head = start;
+}
+
+void SharedHeap::unlinkFreeSpan(uint32_t start) {
+    PageDesc* desc = pages();
+    PageDesc& span = desc[start];
+    if (span.prev_free != NO_PAGE) {
+        desc[span.prev_free].next_free = span.next_free;
+    } else {
+        header()->free_spans[freeListIndex(span.span_pages)] = span.next_free;
+    }
+    if (span.next_free != NO_PAGE) desc[span.next_free].prev_free = span.prev_free;
+}
+
+uint32_t SharedHeap::allocateSpan(uint32_t num_pages, uint8_t kind, uint8_t size_class) {
+    Header* h = header();
+    PageDesc* desc = pages();
+    uint32_t found = NO_PAGE;
+    for (size_t list = freeListIndex(num_pages); list < FREE_LISTS - 1 && found == NO_PAGE; ++list) {
+        found = h->free_spans[list];
+    }
+    for (uint32_t page = h->free_spans[FREE_LISTS - 1]; found == NO_PAGE && page != NO_PAGE;
+         page = desc[page].next_free) {
+        if (desc[page].span_pages >= num_pages) found = page;
+    }
+    if (found == NO_PAGE) return NO_PAGE;
+
+    uint32_t available = desc[found].span_pages;
+    unlinkFreeSpan(found);
+    if (available > num_pages) pushFreeSpan(found + num_pages, available - num_pages);
+    markSpan(found, num_pages, kind, size_class);
+    (kind == PAGE_SMALL ? h->small_pages : h->large_pages) += num_pages;
+    return found;
+}
+
+void SharedHeap::releaseSpan(uint32_t start) {
+    Header* h = header();
+    PageDesc* desc = pages();
+    uint32_t num_pages = desc[start].span_pages;
+    h->large_pages -= num_pages;
+
+    if (start > 0 && desc[start - 1].kind == PAGE_FREE) {
+        uint32_t left = desc[start - 1].span_start;
+        unlinkFreeSpan(left);
+        num_pages += start - left;
+        start = left;
+    }
+    uint32_t right = start + num_pages;
+    if (right < h->num_pages && desc[right].kind == PAGE_FREE) {
+        num_pages += desc[right].span_pages;
+        unlinkFreeSpan(right);
+    }
+    pushFreeSpan(start, num_pages);
+}
+
+// --- Allocation ---
+// Small blocks have no header: the page descriptor gives the class. Fresh
+// spans are cut lazily from a per-class bump region, and freed blocks are
+// linked by offset so the list reads the same in every process.
+void* SharedHeap::allocateSmall(size_t class_index) {
+    Header* h = header();
+    ClassState& cls = h->classes[class_index];
+    SharedLock lock(h, &cls.lock);
+
+    char* block;
+    if (cls.free_head != 0) {
+        block = base + cls.free_head;
+        cls.free_head = *(uint64_t*)block;
+    } else {
+        if (cls.bump_next == cls.bump_end) {
+            uint32_t start;
+            {
+                SharedLock heap_lock(h, &h->heap_lock);
+                start = allocateSpan(SMALL_SPAN_PAGES, PAGE_SMALL, (uint8_t)class_index);
+            }
+            if (start == NO_PAGE) return nullptr;
+            cls.bump_next = toOffset(pageAddress(start));
+            cls.bump_end = cls.bump_next + (SMALL_SPAN_PAGES << PAGE_SHIFT);
+        }
+        block = base + cls.bump_next;
+        cls.bump_next += SIZE_CLASSES[class_index];
+    }
+    ++cls.live_blocks;
+    return block;
+}
+
+void SharedHeap::deallocateSmall(void* ptr, size_t class_index) {
+    Header* h = header();
+    ClassState& cls = h->classes[class_index];
+    SharedLock lock(h, &cls.lock);
+    *(uint64_t*)ptr = cls.free_head;
+    cls.free_head = toOffset(ptr);
+    --cls.live_blocks;
+}
+
+void* SharedHeap::allocate(size_t size) {
+    if (size == 0) size = 1;
+    if (size <= MAX_SMALL_ALLOC_SIZE) return allocateSmall(MyAllocator::getSizeClassIndex(size));
+    if (size > mapped_bytes) return nullptr;
+
+    uint32_t num_pages = (uint32_t)((size + PAGE_BYTES - 1) >> PAGE_SHIFT);
+    uint32_t start;
+    {
+        SharedLock lock(header(), &header()->heap_lock);
+        start = allocateSpan(num_pages, PAGE_LARGE);
+    }
+    return start == NO_PAGE ? nullptr : pageAddress(start);
+}
+
+void SharedHeap::deallocate(void* ptr) {
+    if (ptr == nullptr) return;
+    uint32_t page = pageOf(ptr);
+    const PageDesc& desc = pages()[page];
+    if (desc.kind == PAGE_SMALL) {
+        deallocateSmall(ptr, desc.size_class);
+        return;
+    }
+
+    // The span still belongs to the caller, so its pages can be handed back
+    // to the kernel before the lock is taken.
+    if (desc.span_pages >= PUNCH_PAGES) {
+        madvise(ptr, (size_t)desc.span_pages << PAGE_SHIFT, MADV_REMOVE);
+    }
+    SharedLock lock(header(), &header()->heap_lock);
+    releaseSpan(page);
+}
+
+// --- Statistics ---
+SharedHeap::Stats SharedHeap::getStats() const {
+    Header* h = header();
+    Stats stats{};
+    stats.capacity = mapped_bytes;
+    stats.data_bytes = (size_t)h->num_pages << PAGE_SHIFT;
+    {
+        SharedLock lock(h, &h->heap_lock);
+        stats.small_span_bytes = h->small_pages << PAGE_SHIFT;
+        stats.large_bytes = h->large_pages << PAGE_SHIFT;
+        for (uint32_t head : h->free_spans) {
+            for (uint32_t page = head; page != NO_PAGE; page = pages()[page].next_free) ++stats.free_runs;
+        }
+    }
+    stats.used_bytes = stats.small_span_bytes + stats.large_bytes;
+    for (ClassState& cls : h->classes) {
+        SharedLock lock(h, &cls.lock);
+        stats.live_small_blocks += cls.live_blocks;
+    }
+    stats.lock_recoveries = h->lock_recoveries.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,206 @@
+// shared_heap.h
+
+#pragma once
+
+#include "allocator.h" // For the size classes and PAGE_BYTES
+#include <cstddef>
+#include <cstdint>
+#include <pthread.h>   // For process-shared mutexes
+
+// A heap that lives entirely inside one shared mapping of a memfd or a
+// file: pages, span metadata and free lists are all stored in the mapping
+// and refer to each other by offset. Any process that maps it can allocate
+// and free blocks, including blocks allocated by another process, and hand
+// structures over by offset instead of copying them. A file-backed heap
+// also outlives its processes: reopening it maps the file and checks the
+// header, without rebuilding anything stored in it.
+//
+// There are no per-thread caches: every operation takes a process-shared
+// lock, so a process that dies can never strand blocks in a private cache.
+// The locks are robust, so a process dying while holding one does not wedge
+// the others.
+class SharedHeap {
+public:
+    // Creates a heap of `capacity` bytes in a new memfd. When `base` is
+    // given the heap is mapped there (and nowhere else). Returns nullptr on
+    // failure.
+    static SharedHeap* create(const char* name, size_t capacity, void* base = nullptr);
+    // Maps an existing heap from a descriptor (inherited over fork/exec or
+    // received over a Unix socket). The creator's address is tried first;
+    // if it is taken the heap is mapped elsewhere and only offsets carry
+    // over. Returns nullptr if the descriptor does not hold a heap.
+    static SharedHeap* attach(int fd);
+    // Opens the persistent heap in `path`, creating a `capacity`-byte file
+    // if there is none (capacity is ignored otherwise). Several processes
+    // may have the file open at once. Returns nullptr if the file is not a
+    // heap or its span metadata is damaged beyond repair.
+    static SharedHeap* open(const char* path, size_t capacity, void* base = nullptr);
+    // Unmaps this process's view and closes its descriptor. The heap itself
+    // lives on while any process still maps it; the last process to close a
+    // file-backed heap flushes it and marks it cleanly closed.
+    ~SharedHeap();
+
+    void* allocate(size_t size);
+    void deallocate(void* ptr);
+
+    // --- Offsets ---
+    // Offset 0 is the heap header, so it doubles as the null offset.
+    uint64_t toOffset(const void* ptr) const {
+        return ptr ? (uint64_t)((const char*)ptr - base) : 0;
+    }
+    void* fromOffset(uint64_t offset) const { return offset ? base + offset : nullptr; }
+    template <typename T>
+    T* fromOffset(uint64_t offset) const { return static_cast<T*>(fromOffset(offset)); }
+
+    bool contains(const void* ptr) const {
+        return (const char*)ptr >= base + data_offset && (const char*)ptr < base + mapped_bytes;
+    }
+    // True when mapped at the creator's address, so raw pointers into the
+    // heap mean the same thing in every process that is also fixed.
+    bool isFixedBase() const;
+    int fd() const { return heap_fd; }
+
+    // --- Persistence ---
+    // The root is the entry point to whatever the heap holds, kept as an
+    // offset in the header so it survives a reopen at another address.
+    void setRoot(void* ptr);
+    void* root() const;
+    // Writes the whole mapping back to the file; false on I/O error.
+    bool sync();
+    // False if the previous session ended without closing the heap (for
+    // example a crash): the span lists were rebuilt from the page
+    // descriptors, but an object being written at the time may be torn.
+    bool wasCleanlyClosed() const { return clean_open; }
+
+    struct Stats {
+        size_t capacity;          // Bytes in the mapping, metadata included
+        size_t data_bytes;        // Bytes available for spans
+        size_t used_bytes;        // Bytes in small or large spans
+        size_t small_span_bytes;  // Spans carved into small blocks
+        size_t large_bytes;       // Spans handed out as large blocks
+        size_t free_runs;         // Maximal runs of free pages
+        size_t live_small_blocks; // Small blocks allocated and not yet freed
+        size_t lock_recoveries;   // Locks taken over from a dead owner
+    };
+    Stats getStats() const;
+
+private:
+    static constexpr char MAGIC[8] = {'M', 'Y', 'S', 'H', 'H', 'E', 'A', 'P'};
+    static constexpr uint32_t VERSION = 2;
+    static constexpr uint32_t NO_PAGE = UINT32_MAX;
+    static constexpr size_t PAGE_SHIFT = 12;
+    static constexpr size_t SMALL_SPAN_PAGES = 4;
+    static constexpr size_t PUNCH_PAGES = 16; // Freed large spans this big go back to the kernel
+    static constexpr size_t FREE_LISTS = MAX_SPAN_PAGES + 1; // Exact lengths, then one first-fit list
+
+    static_assert(PAGE_BYTES == (size_t)1 << PAGE_SHIFT, "page size mismatch");
+
+    enum PageKind : uint8_t { PAGE_FREE, PAGE_SMALL, PAGE_LARGE };
+
+    // One per data page. Every span keeps its first and last descriptor
+    // current (for coalescing); small spans keep all of them current so any
+    // block can find its class.
+    struct PageDesc {
+        uint32_t span_start;
+        uint32_t span_pages;
+        uint32_t next_free; // Free-span list links, on a free span's first page
+        uint32_t prev_free;
+        uint8_t kind;
+        uint8_t size_class;
+    };
+
+    struct ClassState {
+        pthread_mutex_t lock;
+        uint64_t free_head;  // Offset of the first freed block
+        uint64_t bump_next;  // Uncut part of the newest span
+        uint64_t bump_end;
+        uint64_t live_blocks;
+    };
+
+    // Offset 0 of the mapping; the page descriptors follow it.
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t page_bytes;
+        uint32_t header_bytes; // Catches a different pthread ABI
+        uint32_t clean;        // Set by the last process to close a file heap
+        uint64_t capacity;
+        uint64_t base_address; // Where the creator mapped the heap
+        uint64_t data_offset;  // Page 0 of the data area
+        uint32_t num_pages;
+        pthread_mutex_t heap_lock; // Page descriptors and free-span lists
+        uint32_t free_spans[FREE_LISTS];
+        uint64_t small_pages;
+        uint64_t large_pages;
+        uint64_t root_offset;
+        std::atomic<uint64_t> lock_recoveries;
+        ClassState classes[8];
+    };
+
+    class SharedLock {
+    public:
+        SharedLock(Header* header, pthread_mutex_t* mtx);
+        ~SharedLock() { pthread_mutex_unlock(mtx); }
+    private:
+        pthread_mutex_t* mtx;
+    };
+
+    SharedHeap(char* base, size_t mapped_bytes, int fd);
+    static void initMutex(pthread_mutex_t* mtx);
+    static size_t metadataBytes(size_t num_pages);
+    static SharedHeap* format(int fd, size_t capacity, void* base);
+    static SharedHeap* mapExisting(int fd, void* base);
+    static bool lockFile(int fd, short type, bool wait);
+    void initLocks();
+    bool rebuildSpanLists();
+
+    Header* header() const { return (Header*)base; }
+    PageDesc* pages() const { return (PageDesc*)(base + sizeof(Header)); }
+    char* pageAddress(uint32_t page) const { return base + data_offset + ((size_t)page << PAGE_SHIFT); }
+    uint32_t pageOf(const void* ptr) const {
+        return (uint32_t)(((const char*)ptr - base - data_offset) >> PAGE_SHIFT);
+    }
+
+    // Caller holds heap_lock for all of the span helpers.
+    static size_t freeListIndex(size_t num_pages);
+    void markSpan(uint32_t start, uint32_t num_pages, uint8_t kind, uint8_t size_class = 0);
+    void pushFreeSpan(uint32_t start, uint32_t num_pages);
+    void unlinkFreeSpan(uint32_t start);
+    uint32_t allocateSpan(uint32_t num_pages, uint8_t kind, uint8_t size_class = 0);
+    void releaseSpan(uint32_t start);
+
+    void* allocateSmall(size_t class_index);
+    void deallocateSmall(void* ptr, size_t class_index);
+
+    char* base;
+    size_t mapped_bytes;
+    size_t data_offset;
+    int heap_fd;
+    bool persistent = false; // Opened from a file path
+    bool clean_open = true;
+};
+
+// A pointer stored as the distance from itself to its target, so a linked
+// structure built in a SharedHeap reads correctly in a process that mapped
+// the heap at a different address. It cannot point at itself; that
+// distance is the null value.
+template <typename T>
+class OffsetPtr {
+public:
+    OffsetPtr() = default;
+    OffsetPtr(T* ptr) { *this = ptr; }
+    OffsetPtr(const OffsetPtr& other) { *this = other.get(); }
+    OffsetPtr& operator=(const OffsetPtr& other) { return *this = other.get(); }
+    OffsetPtr& operator=(T* ptr) {
+        delta = ptr ? (intptr_t)ptr - (intptr_t)this : 0;
+        return *this;
+    }
+
+    T* get() const { return delta ? (T*)((intptr_t)this + delta) : nullptr; }
+    T* operator->() const { return get(); }
+    T& operator*() const { return *get(); }
+    explicit operator bool() const { return delta != 0; }
+
+private:
+    intptr_t delta = 0;
+};
@@ -0,0 +1,337 @@
+// shared_heap_test.cpp
+//
+// Multi-process test for SharedHeap. Worker processes build linked lists of
+// pattern-filled nodes (small and large) in one heap and publish them by
+// offset. A second round of workers verifies and frees another worker's
+// list while building new ones, so blocks are freed by a different process
+// than the one that allocated them. Half of the workers map the heap at the
+// creator's address and half at a different one, so the lists are linked
+// with OffsetPtr. At the end the parent frees everything and checks that
+// the heap is empty again.
+//
+// A second part runs the same lists through a file-backed heap: one process
+// builds a list under the root and closes cleanly, the next reopens it,
+// checks the list and exits without closing, and the parent reopens the
+// crashed heap and frees everything. Then a process reopens the file while
+// another is closing it and crashes, and the next open must still recover.
+//
+// Usage: shared_heap_test [seed] [processes] [nodes-per-process]
+
+#include "shared_heap.h"
+#include "test_util.h"
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+const size_t HEAP_CAPACITY = 256 << 20;
+const size_t MAX_PAYLOAD = 6000; // Past MAX_SMALL_ALLOC_SIZE, so both paths run
+const int MAX_PROCESSES = 64;
+const int CLOSE_RACE_ITERATIONS = 20;
+const int OPENER_RACED = 2; // Exit status of an opener that hit the closer's flush
+
+struct Node {
+    OffsetPtr<Node> next;
+    uint64_t id;
+    size_t payload;
+    unsigned char* data() { return (unsigned char*)(this + 1); }
+};
+
+// Published list heads, allocated in the heap itself. Round r frees the
+// lists in buffer (r - 1) % 2 and publishes new ones in buffer r % 2, so
+// every slot has exactly one reader and one writer per round.
+struct Mailbox {
+    uint64_t heads[2][MAX_PROCESSES]; // Offset of each worker's first node
+    uint64_t counts[2][MAX_PROCESSES];
+};
+
+// --- List Building and Checking ---
+static Node* buildList(SharedHeap* heap, std::mt19937_64& rng, int worker, int round, int nodes) {
+    Node* head = nullptr;
+    for (int i = 0; i < nodes; ++i) {
+        size_t payload = rng() % 3 == 0 ? rng() % MAX_PAYLOAD : rng() % 200;
+        Node* node = (Node*)heap->allocate(sizeof(Node) + payload);
+        CHECK(node != nullptr, "allocate(%zu) failed", sizeof(Node) + payload);
+        if (node == nullptr) break;
+        CHECK(heap->contains(node), "block %p is outside the heap", (void*)node);
+        node->id = ((uint64_t)worker << 40) | ((uint64_t)round << 32) | (uint64_t)i;
+        node->payload = payload;
+        for (size_t b = 0; b < payload; ++b) node->data()[b] = patternByte(node->id, b);
+        node->next = head;
+        head = node;
+    }
+    return head;
+}
+
+static void freeList(SharedHeap* heap, Node* head, uint64_t expected, bool keep = false) {
+    uint64_t count = 0;
+    while (head) {
+        for (size_t b = 0; b < head->payload; ++b) {
+            if (head->data()[b] != patternByte(head->id, b)) {
+                CHECK(false, "node %llx corrupted at byte %zu", (unsigned long long)head->id, b);
+                break;
+            }
+        }
+        Node* next = head->next.get();
+        if (!keep) heap->deallocate(head);
+        head = next;
+        ++count;
+    }
+    CHECK(count == expected, "list had %llu nodes, expected %llu", (unsigned long long)count,
+          (unsigned long long)expected);
+}
+
+// --- Worker Processes ---
+// Even workers drop the mapping inherited over fork and attach afresh, which
+// lands at the creator's address; odd workers attach a second view while the
+// inherited one still occupies that address, so theirs is relocated.
+static void worker(SharedHeap* inherited, uint64_t mailbox_offset, uint64_t seed, int index,
+                   int processes, int round, int nodes) {
+    SharedHeap* heap;
+    if (index % 2 == 0) {
+        int fd = dup(inherited->fd());
+        delete inherited;
+        heap = SharedHeap::attach(fd);
+        close(fd);
+        CHECK(heap && heap->isFixedBase(), "worker %d: attach at the creator's address failed", index);
+    } else {
+        heap = SharedHeap::attach(inherited->fd());
+        CHECK(heap && !heap->isFixedBase(), "worker %d: expected a relocated mapping", index);
+    }
+    if (heap == nullptr) _exit(1);
+
+    Mailbox* mailbox = heap->fromOffset<Mailbox>(mailbox_offset);
+    std::mt19937_64 rng(seed * 1000003 + round * 7919 + index);
+    if (round > 0) {
+        int victim = (index + 1) % processes;
+        int in = (round - 1) % 2;
+        freeList(heap, heap->fromOffset<Node>(mailbox->heads[in][victim]), mailbox->counts[in][victim]);
+    }
+    int out = round % 2;
+    mailbox->heads[out][index] = heap->toOffset(buildList(heap, rng, index, round, nodes));
+    mailbox->counts[out][index] = nodes;
+    _exit(failures == 0 ? 0 : 1);
+}
+
+static void runRound(SharedHeap* heap, uint64_t mailbox_offset, uint64_t seed, int processes,
+                     int round, int nodes) {
+    for (int i = 0; i < processes; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) worker(heap, mailbox_offset, seed, i, processes, round, nodes);
+        CHECK(pid > 0, "fork failed");
+    }
+    for (int i = 0; i < processes; ++i) {
+        int status = 0;
+        wait(&status);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0, "round %d: a worker failed", round);
+    }
+}
+
+// --- Persistence ---
+struct PersistentRoot {
+    OffsetPtr<Node> head;
+    uint64_t count;
+};
+
+static int waitForChild(pid_t pid) {
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+static void testPersistence(uint64_t seed, int nodes) {
+    fflush(stdout); // Session 2 prints, so it must not inherit buffered output
+    char path[] = "/tmp/myalloc-heap-XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0, "mkstemp failed");
+    if (fd < 0) return;
+    close(fd);
+
+    // Session 1 builds the list and closes cleanly.
+    pid_t pid = fork();
+    if (pid == 0) {
+        SharedHeap* heap = SharedHeap::open(path, HEAP_CAPACITY);
+        if (heap == nullptr) _exit(1);
+        std::mt19937_64 rng(seed);
+        PersistentRoot* root = (PersistentRoot*)heap->allocate(sizeof(PersistentRoot));
+        root->head = buildList(heap, rng, 0, 0, nodes);
+        root->count = nodes;
+        heap->setRoot(root);
+        delete heap;
+        _exit(failures == 0 ? 0 : 1);
+    }
+    CHECK(waitForChild(pid) == 0, "session 1 failed");
+
+    // Session 2 reopens it, checks the list in place and "crashes".
+    pid = fork();
+    if (pid == 0) {
+        auto start = std::chrono::steady_clock::now();
+        SharedHeap* heap = SharedHeap::open(path, 0);
+        double open_us = std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - start).count();
+        if (heap == nullptr) _exit(1);
+        CHECK(heap->wasCleanlyClosed(), "session 1 closed the heap cleanly");
+        PersistentRoot* root = (PersistentRoot*)heap->root();
+        CHECK(root != nullptr, "root lost across reopen");
+        if (root) freeList(heap, root->head.get(), root->count, true);
+        printf("Reopened %zu MB heap with %d nodes in %.0f us\n", HEAP_CAPACITY >> 20, nodes, open_us);
+        fflush(stdout);
+        _exit(failures == 0 ? 0 : 1);
+    }
+    CHECK(waitForChild(pid) == 0, "session 2 failed");
+
+    // Session 3 recovers the crashed heap and empties it.
+    SharedHeap* heap = SharedHeap::open(path, 0);
+    CHECK(heap != nullptr, "reopen after a crash failed");
+    if (heap) {
+        CHECK(!heap->wasCleanlyClosed(), "session 2 did not close the heap");
+        PersistentRoot* root = (PersistentRoot*)heap->root();
+        CHECK(root != nullptr, "root lost across a crash");
+        if (root) freeList(heap, root->head.get(), root->count);
+        heap->deallocate(root);
+        heap->setRoot(nullptr);
+        SharedHeap::Stats stats = heap->getStats();
+        CHECK(stats.live_small_blocks == 0 && stats.large_bytes == 0,
+              "persistent heap not empty: %zu small blocks, %zu large bytes", stats.live_small_blocks,
+              stats.large_bytes);
+        delete heap;
+    }
+    unlink(path);
+}
+
+// Waits for the closer to get past its read lock: returns F_WRLCK while
+// it holds the write lock to flush the file, or F_UNLCK if it already let go.
+static short closingLock(const char* path) {
+    int fd = ::open(path, O_RDWR | O_CLOEXEC);
+    struct flock lock = {};
+    do {
+        lock = {};
+        lock.l_type = F_WRLCK;
+        lock.l_whence = SEEK_SET;
+        if (fd < 0 || fcntl(fd, F_OFD_GETLK, &lock) != 0) break;
+    } while (lock.l_type == F_RDLCK && sched_yield() == 0);
+    if (fd >= 0) close(fd);
+    return lock.l_type;
+}
+
+// Opens the heap while its last user is closing it: the opener waits until
+// the closer holds the write lock to flush the file, so its open blocks on
+// the read lock until the closer has marked the file clean. The opener
+// outlives the closer and then "crashes", so its session must count as
+// unclean and the next open must recover the heap.
+static void testCloseRace(uint64_t seed, int nodes, int iterations) {
+    char path[] = "/tmp/myalloc-heap-XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0, "mkstemp failed");
+    if (fd < 0) return;
+    close(fd);
+
+    int i = 0, races = 0;
+    for (; i < iterations && failures == 0; ++i) {
+        int go[2], done[2];
+        CHECK(pipe(go) == 0 && pipe(done) == 0, "pipe failed");
+        pid_t closer = fork();
+        if (closer == 0) {
+            SharedHeap* heap = SharedHeap::open(path, HEAP_CAPACITY);
+            if (heap == nullptr) _exit(1);
+            std::mt19937_64 rng(seed + i);
+            PersistentRoot* root = (PersistentRoot*)heap->allocate(sizeof(PersistentRoot));
+            root->head = buildList(heap, rng, 0, i, nodes);
+            root->count = nodes;
+            heap->setRoot(root);
+            if (write(go[1], "x", 1) != 1) _exit(1);
+            delete heap;
+            _exit(failures == 0 ? 0 : 1);
+        }
+        pid_t opener = fork();
+        if (opener == 0) {
+            char byte;
+            close(go[1]);
+            if (read(go[0], &byte, 1) != 1) _exit(1);
+            bool raced = closingLock(path) == F_WRLCK;
+            SharedHeap* heap = SharedHeap::open(path, 0);
+            close(done[1]);
+            if (read(done[0], &byte, 1) != 0) _exit(1); // Outlive the closer
+            if (heap == nullptr || heap->root() == nullptr) _exit(1);
+            _exit(raced ? OPENER_RACED : 0);
+        }
+        close(go[0]);
+        close(go[1]);
+        close(done[0]);
+        CHECK(waitForChild(closer) == 0, "iteration %d: closer failed", i);
+        close(done[1]);
+        int status = waitForChild(opener);
+        CHECK(status == 0 || status == OPENER_RACED, "iteration %d: opener failed", i);
+        races += status == OPENER_RACED;
+
+        SharedHeap* heap = SharedHeap::open(path, 0);
+        CHECK(heap != nullptr, "iteration %d: reopen after a crash failed", i);
+        if (heap == nullptr) break;
+        CHECK(!heap->wasCleanlyClosed(), "iteration %d: the opener's crash left the heap marked clean", i);
+        PersistentRoot* root = (PersistentRoot*)heap->root();
+        CHECK(root != nullptr, "iteration %d: root lost", i);
+        if (root) {
+            freeList(heap, root->head.get(), root->count);
+            heap->deallocate(root);
+        }
+        heap->setRoot(nullptr);
+        delete heap;
+    }
+    printf("Recovered %d sessions opened during a close (%d during its flush)\n", i, races);
+    unlink(path);
+}
+
+int main(int argc, char** argv) {
+    uint64_t seed = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1;
+    int processes = argc > 2 ? atoi(argv[2]) : 4;
+    int nodes = argc > 3 ? atoi(argv[3]) : 2000;
+    const int rounds = 3;
+    if (processes < 2 || processes > MAX_PROCESSES) processes = 4;
+    printf("Shared heap test: seed=%llu processes=%d nodes=%d\n", (unsigned long long)seed,
+           processes, nodes);
+
+    SharedHeap* heap = SharedHeap::create("myalloc-test", HEAP_CAPACITY);
+    CHECK(heap != nullptr, "SharedHeap::create failed");
+    if (heap == nullptr) return 1;
+    CHECK(heap->isFixedBase(), "the creator must be at its own base");
+
+    Mailbox* mailbox = (Mailbox*)heap->allocate(sizeof(Mailbox));
+    CHECK(mailbox != nullptr, "mailbox allocation failed");
+    if (mailbox == nullptr) return 1;
+    *mailbox = Mailbox{};
+    uint64_t mailbox_offset = heap->toOffset(mailbox);
+
+    for (int round = 0; round < rounds && failures == 0; ++round) {
+        runRound(heap, mailbox_offset, seed, processes, round, nodes);
+    }
+    int last = (rounds - 1) % 2;
+    for (int i = 0; i < processes; ++i) {
+        freeList(heap, heap->fromOffset<Node>(mailbox->heads[last][i]), mailbox->counts[last][i]);
+    }
+    heap->deallocate(mailbox);
+
+    // Everything is free: no live blocks, and the freed large spans have
+    // coalesced, so free runs are only split by the small spans between them.
+    SharedHeap::Stats stats = heap->getStats();
+    CHECK(stats.live_small_blocks == 0, "%zu small blocks still live", stats.live_small_blocks);
+    CHECK(stats.large_bytes == 0, "%zu large bytes still live", stats.large_bytes);
+    CHECK(stats.lock_recoveries == 0, "%zu locks recovered from dead owners", stats.lock_recoveries);
+    CHECK(stats.free_runs <= stats.small_span_bytes / PAGE_BYTES + 1,
+          "%zu free runs around %zu small span pages", stats.free_runs, stats.small_span_bytes / PAGE_BYTES);
+    printf("Small spans: %zu KB of %zu KB, free runs: %zu\n", stats.small_span_bytes >> 10,
+           stats.data_bytes >> 10, stats.free_runs);
+    delete heap;
+
+    if (failures == 0) testPersistence(seed, nodes);
+    if (failures == 0) testCloseRace(seed, nodes, CLOSE_RACE_ITERATIONS);
+    if (failures != 0) {
+        printf("Shared heap test FAILED: %d check(s)\n", failures.load());
+        return 1;
+    }
+    printf("Shared heap test passed\n");
+    return 0;
+}
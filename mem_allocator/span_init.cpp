@@ -0,0 +1,215 @@
+// span_init.cpp
+
+#include "span_init.h"
+#include <atomic>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define SPAN_INIT_X86 1
+#endif
+
+// --- Level Selection ---
+static SpanInit::Level probeLevel() {
+#ifdef SPAN_INIT_X86
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(edx & bit_SSE2)) return SpanInit::Level::Scalar;
+
+    // AVX2 also needs the OS to save the upper halves of the YMM registers.
+    bool avx = (ecx & bit_OSXSAVE) && (ecx & bit_AVX);
+    if (avx) {
+        unsigned xcr0_lo, xcr0_hi;
+        __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+        avx = (xcr0_lo & 6) == 6;
+    }
+    if (avx && __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ebx & bit_AVX2)) {
+        return SpanInit::Level::AVX2;
+    }
+    return SpanInit::Level::SSE2;
+#else
+    return SpanInit::Level::Scalar;
+#endif
+}
+
+static constexpr int LEVEL_UNKNOWN = -1;
+static std::atomic<int> active_level{LEVEL_UNKNOWN};
+
+SpanInit::Level SpanInit::detectedLevel() {
+    static const Level detected = probeLevel();
+    return detected;
+}
+
+SpanInit::Level SpanInit::level() {
+    int current = active_level.load(std::memory_order_relaxed);
+    if (__builtin_expect(current == LEVEL_UNKNOWN, 0)) {
+        current = (int)detectedLevel();
+        active_level.store(current, std::memory_order_relaxed);
+    }
+    return (Level)current;
+}
+
+void SpanInit::setLevel(Level level) {
+    if ((int)level > (int)detectedLevel()) level = detectedLevel();
+    active_level.store((int)level, std::memory_order_relaxed);
+}
+
+const char* SpanInit::levelName(Level level) {
+    switch (level) {
+    case Level::Scalar: return "scalar";
+    case Level::SSE2: return "sse2";
+    case Level::AVX2: return "avx2";
+    }
+    return "unknown";
+}
+
+// --- Scalar Kernels ---
+// Also finish the blocks the vector loops leave over.
+static void threadScalar(char* block, size_t count, size_t block_size, uintptr_t tail, uintptr_t tag,
+                         uintptr_t key) {
+    for (size_t i = 1; i < count; ++i, block += block_size) {
+        *(uintptr_t*)block = (((uintptr_t)block + block_size) | tag) ^ key;
+    }
+    if (count > 0) *(uintptr_t*)block = (tail | tag) ^ key;
+}
+
+static void exportScalar(char* block, size_t count, size_t block_size, uint64_t header, void** out) {
+    for (size_t i = 0; i < count; ++i, block += block_size) {
+        *(uint64_t*)block = header;
+        out[i] = block + sizeof(uint64_t);
+    }
+}
+
+#ifdef SPAN_INIT_X86
+// --- SSE2 Kernels ---
+// Two links per vector: the address arithmetic and tagging run two blocks
+// at a time, with one 8-byte store per block.
+static void threadSse2(char* start, size_t count, size_t block_size, uintptr_t tail, uintptr_t tag,
+                       uintptr_t key) {
+    size_t links = count - 1; // The last block links to tail
+    size_t i = 0;
+    __m128i next = _mm_set_epi64x((long long)((uintptr_t)start + 2 * block_size),
+                                  (long long)((uintptr_t)start + block_size));
+    __m128i step = _mm_set1_epi64x((long long)(2 * block_size));
+    __m128i tags = _mm_set1_epi64x((long long)tag);
+    __m128i keys = _mm_set1_epi64x((long long)key);
+    for (; i + 2 <= links; i += 2) {
+        __m128i link = _mm_xor_si128(_mm_or_si128(next, tags), keys);
+        char* block = start + i * block_size;
+        _mm_storel_epi64((__m128i*)block, link);
+        _mm_storeh_pd((double*)(block + block_size), _mm_castsi128_pd(link));
+        next = _mm_add_epi64(next, step);
+    }
+    threadScalar(start + i * block_size, count - i, block_size, tail, tag, key);
+}
+
+static void exportSse2(char* start, size_t count, size_t block_size, uint64_t header, void** out) {
+    size_t i = 0;
+    __m128i ptrs = _mm_set_epi64x((long long)((uintptr_t)start + block_size + sizeof(uint64_t)),
+                                  (long long)((uintptr_t)start + sizeof(uint64_t)));
+    __m128i step = _mm_set1_epi64x((long long)(2 * block_size));
+    for (; i + 2 <= count; i += 2) {
+        char* block = start + i * block_size;
+        *(uint64_t*)block = header;
+        *(uint64_t*)(block + block_size) = header;
+        _mm_storeu_si128((__m128i*)(out + i), ptrs);
+        ptrs = _mm_add_epi64(ptrs, step);
+    }
+    exportScalar(start + i * block_size, count - i, block_size, header, out + i);
+}
+
+// --- AVX2 Kernels ---
+// Four links per vector. 16-byte blocks (the 8-byte class) take two per
+// 32-byte store, link and zeroed payload together, halving the stores.
+__attribute__((target("avx2")))
+static void threadAvx2(char* start, size_t count, size_t block_size, uintptr_t tail, uintptr_t tag,
+                       uintptr_t key) {
+    size_t links = count - 1;
+    size_t i = 0;
+    uintptr_t first = (uintptr_t)start + block_size;
+    __m256i next = _mm256_set_epi64x((long long)(first + 3 * block_size), (long long)(first + 2 * block_size),
+                                     (long long)(first + block_size), (long long)first);
+    __m256i step = _mm256_set1_epi64x((long long)(4 * block_size));
+    __m256i tags = _mm256_set1_epi64x((long long)tag);
+    __m256i keys = _mm256_set1_epi64x((long long)key);
+    if (block_size == 16) {
+        __m256i zero = _mm256_setzero_si256();
+        for (; i + 4 <= links; i += 4) {
+            __m256i link = _mm256_xor_si256(_mm256_or_si256(next, tags), keys);
+            __m256i even = _mm256_unpacklo_epi64(link, zero); // [L0 0 | L2 0]
+            __m256i odd = _mm256_unpackhi_epi64(link, zero);  // [L1 0 | L3 0]
+            char* block = start + i * 16;
+            _mm256_storeu_si256((__m256i*)block, _mm256_permute2x128_si256(even, odd, 0x20));
+            _mm256_storeu_si256((__m256i*)(block + 32), _mm256_permute2x128_si256(even, odd, 0x31));
+            next = _mm256_add_epi64(next, step);
+        }
+    } else {
+        for (; i + 4 <= links; i += 4) {
+            __m256i link = _mm256_xor_si256(_mm256_or_si256(next, tags), keys);
+            __m128i low = _mm256_castsi256_si128(link);
+            __m128i high = _mm256_extracti128_si256(link, 1);
+            char* block = start + i * block_size;
+            _mm_storel_epi64((__m128i*)block, low);
+            _mm_storeh_pd((double*)(block + block_size), _mm_castsi128_pd(low));
+            _mm_storel_epi64((__m128i*)(block + 2 * block_size), high);
+            _mm_storeh_pd((double*)(block + 3 * block_size), _mm_castsi128_pd(high));
+            next = _mm256_add_epi64(next, step);
+        }
+    }
+    threadScalar(start + i * block_size, count - i, block_size, tail, tag, key);
+}
+
+__attribute__((target("avx2")))
+static void exportAvx2(char* start, size_t count, size_t block_size, uint64_t header, void** out) {
+    size_t i = 0;
+    uintptr_t first = (uintptr_t)start + sizeof(uint64_t);
+    __m256i ptrs = _mm256_set_epi64x((long long)(first + 3 * block_size), (long long)(first + 2 * block_size),
+                                     (long long)(first + block_size), (long long)first);
+    __m256i step = _mm256_set1_epi64x((long long)(4 * block_size));
+    if (block_size == 16) {
+        __m256i headers = _mm256_set_epi64x(0, (long long)header, 0, (long long)header);
+        for (; i + 4 <= count; i += 4) {
+            char* block = start + i * 16;
+            _mm256_storeu_si256((__m256i*)block, headers);
+            _mm256_storeu_si256((__m256i*)(block + 32), headers);
+            _mm256_storeu_si256((__m256i*)(out + i), ptrs);
+            ptrs = _mm256_add_epi64(ptrs, step);
+        }
+    } else {
+        for (; i + 4 <= count; i += 4) {
+            char* block = start + i * block_size;
+            *(uint64_t*)block = header;
+            *(uint64_t*)(block + block_size) = header;
+            *(uint64_t*)(block + 2 * block_size) = header;
+            *(uint64_t*)(block + 3 * block_size) = header;
+            _mm256_storeu_si256((__m256i*)(out + i), ptrs);
+            ptrs = _mm256_add_epi64(ptrs, step);
+        }
+    }
+    exportScalar(start + i * block_size, count - i, block_size, header, out + i);
+}
+#endif
+
+// --- Dispatch ---
+void SpanInit::threadBlocks(char* start, size_t count, size_t block_size, uintptr_t tail, uintptr_t tag,
+                            uintptr_t key) {
+    if (count == 0) return;
+#ifdef SPAN_INIT_X86
+    switch (level()) {
+    case Level::AVX2: return threadAvx2(start, count, block_size, tail, tag, key);
+    case Level::SSE2: return threadSse2(start, count, block_size, tail, tag, key);
+    case Level::Scalar: break;
+    }
+#endif
+    threadScalar(start, count, block_size, tail, tag, key);
+}
+
+void SpanInit::exportBlocks(char* start, size_t count, size_t block_size, uint64_t header, void** out) {
+#ifdef SPAN_INIT_X86
+    switch (level()) {
+    case Level::AVX2: return exportAvx2(start, count, block_size, header, out);
+    case Level::SSE2: return exportSse2(start, count, block_size, header, out);
+    case Level::Scalar: break;
+    }
+#endif
+    exportScalar(start, count, block_size, header, out);
+}
@@ -0,0 +1,36 @@
+// span_init.h
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Bulk kernels for runs of equal-sized blocks in a fresh span: threading
+// them into a free list and handing them out as a batch. Each has a scalar,
+// an SSE2 and an AVX2 version; the widest one the CPU and OS support is
+// picked with cpuid on first use.
+class SpanInit {
+public:
+    enum class Level { Scalar, SSE2, AVX2 };
+
+    // Widest level this machine supports.
+    static Level detectedLevel();
+    // Level the kernels run at; detectedLevel() unless overridden.
+    static Level level();
+    // Forces a level (clamped to detectedLevel()), e.g. to compare them in a
+    // benchmark. Not meant to be changed while other threads allocate.
+    static void setLevel(Level level);
+    static const char* levelName(Level level);
+
+    // Stores in the first word of each of the count blocks at start the
+    // address of the block after it, and tail in the last one. Every link is
+    // ORed with tag, then XORed with key, before it is stored. The runs are
+    // fresh memory: other words of a 16-byte block may be written with zero.
+    static void threadBlocks(char* start, size_t count, size_t block_size, uintptr_t tail,
+                             uintptr_t tag, uintptr_t key);
+
+    // Stores header in the first word of each block and the address of the
+    // word after it in out[i]. Same fresh-memory rule as threadBlocks.
+    static void exportBlocks(char* start, size_t count, size_t block_size, uint64_t header,
+                             void** out);
+};
@@ -0,0 +1,367 @@
+// stress_test.cpp
+//
+// Deterministic multi-threaded stress test for MyAllocator. Each thread runs
+// a seeded random mix of allocate (with and without a long lifetime hint),
+// allocate_zeroed, allocate_frame, reallocate, batch calls and frees, and
+// hands some blocks to other threads to free. Every block is filled with a
+// pattern derived from its id and checked before it is freed or resized; a
+// shared interval map checks that no two live blocks overlap. Each thread
+// also keeps movable objects, checked through pin(). Thread 0 trims and
+// compacts the heap now and then while the others run. After all threads
+// exit, the allocator statistics must show every small block back in the
+// transfer caches and every large span in the large cache, and a final
+// trim(0) must unmap all of it except the frame spans. The metrics text is
+// rendered last and checked for completeness.
+//
+// Usage: stress_test [seed] [threads] [ops-per-thread]
+//
+// The harness does not replace operator new, so it runs unchanged under
+// -fsanitize=thread and -fsanitize=address.
+
+#include "allocator.h"
+#include "test_util.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+MyAllocator g_allocator;
+
+const int LIVE_SLOTS = 256;     // Blocks each thread holds at once
+const int HANDOFF_CAPACITY = 1024;
+const size_t MAX_LARGE_SIZE = 300 * 1024;
+const size_t HUGE_SIZE = 2 * 1024 * 1024; // Past the large span cache
+
+// A live block remembers which call allocated it, so it is freed the same way.
+struct LiveBlock : Block {
+    bool frame = false; // From allocate_frame, freed with deallocate_frame
+};
+
+// --- Overlap Detection ---
+// Live blocks by start address; a new block must not intersect a neighbour.
+static std::mutex live_mutex;
+static std::map<uintptr_t, size_t> live_ranges;
+
+static void addRange(const Block& b) {
+    uintptr_t start = (uintptr_t)b.ptr;
+    size_t len = b.size ? b.size : 1;
+    std::lock_guard<std::mutex> lock(live_mutex);
+    auto next = live_ranges.lower_bound(start);
+    if (next != live_ranges.end()) {
+        CHECK(start + len <= next->first, "block %p+%zu overlaps live block %p",
+              (void*)start, len, (void*)next->first);
+    }
+    if (next != live_ranges.begin()) {
+        auto prev = std::prev(next);
+        CHECK(prev->first + prev->second <= start, "block %p+%zu overlaps live block %p+%zu",
+              (void*)start, len, (void*)prev->first, prev->second);
+    }
+    live_ranges[start] = len;
+}
+
+static void removeRange(const Block& b) {
+    std::lock_guard<std::mutex> lock(live_mutex);
+    CHECK(live_ranges.erase((uintptr_t)b.ptr) == 1, "freeing block %p that is not live", (void*)b.ptr);
+}
+
+// --- Cross-Thread Handoff ---
+// Blocks pushed here are verified and freed by whichever thread pops them.
+static std::mutex handoff_mutex;
+static std::vector<LiveBlock> handoff;
+
+static bool pushHandoff(const LiveBlock& b) {
+    std::lock_guard<std::mutex> lock(handoff_mutex);
+    if (handoff.size() >= HANDOFF_CAPACITY) return false;
+    handoff.push_back(b);
+    return true;
+}
+
+static bool popHandoff(LiveBlock* b) {
+    std::lock_guard<std::mutex> lock(handoff_mutex);
+    if (handoff.empty()) return false;
+    *b = handoff.back();
+    handoff.pop_back();
+    return true;
+}
+
+// --- Movable Objects ---
+// Not in the interval map: compact() moves them. A nested pin must return
+// the same address, and the pattern must survive any number of moves.
+const int MOVABLE_SLOTS = 64;
+
+struct Movable {
+    MyAllocator::Handle handle;
+    size_t size = 0;
+    uint64_t id = 0;
+};
+
+static void checkMovable(const Movable& m) {
+    Block b;
+    b.ptr = g_allocator.pin<unsigned char>(m.handle);
+    b.size = m.size;
+    b.id = m.id;
+    checkBlock(b);
+    CHECK(g_allocator.pin<unsigned char>(m.handle) == b.ptr, "movable object %llu moved while pinned",
+          (unsigned long long)m.id);
+    g_allocator.unpin(m.handle);
+    g_allocator.unpin(m.handle);
+}
+
+// --- Worker ---
+static size_t randomSize(std::mt19937_64& rng) {
+    unsigned pick = rng() % 100;
+    if (pick < 80) return 1 + rng() % MAX_SMALL_ALLOC_SIZE;
+    if (pick < 99) return MAX_SMALL_ALLOC_SIZE + 1 + rng() % (MAX_LARGE_SIZE - MAX_SMALL_ALLOC_SIZE);
+    return HUGE_SIZE + rng() % 4096;
+}
+
+static uint64_t nextId(int thread, uint64_t& counter) {
+    return ((uint64_t)thread << 40) | ++counter;
+}
+
+static void freeBlock(LiveBlock& b) {
+    checkBlock(b);
+    removeRange(b);
+    if (b.frame) g_allocator.deallocate_frame(b.ptr, b.size);
+    else g_allocator.deallocate(b.ptr);
+    b = LiveBlock{};
+}
+
+static void worker(uint64_t seed, int thread, int ops) {
+    std::mt19937_64 rng(seed * 1000003 + thread);
+    std::vector<LiveBlock> slots(LIVE_SLOTS);
+    std::vector<Movable> movables(MOVABLE_SLOTS);
+    uint64_t id_counter = 0;
+
+    for (int op = 0; op < ops; ++op) {
+        LiveBlock& b = slots[rng() % LIVE_SLOTS];
+        unsigned action = rng() % 100;
+
+        if (b.ptr == nullptr) {
+            b.size = randomSize(rng);
+            b.id = nextId(thread, id_counter);
+            if (action < 20) {
+                b.ptr = (unsigned char*)g_allocator.allocate_zeroed(1, b.size);
+                CHECK(b.ptr != nullptr, "allocate_zeroed(%zu) failed", b.size);
+                if (b.ptr == nullptr) continue;
+                for (size_t i = 0; i < b.size; ++i) {
+                    if (b.ptr[i] != 0) {
+                        CHECK(false, "allocate_zeroed(%zu) byte %zu is not zero", b.size, i);
+                        break;
+                    }
+                }
+            } else if (action < 30) {
+                b.ptr = (unsigned char*)g_allocator.allocate(b.size, MyAllocator::Lifetime::Long);
+                CHECK(b.ptr != nullptr, "allocate(%zu, Long) failed", b.size);
+                if (b.ptr == nullptr) continue;
+            } else if (action < 35) {
+                // Coroutine-frame sizes, a few past MAX_FRAME_SIZE to take the fallback.
+                b.size = 1 + rng() % (MyAllocator::MAX_FRAME_SIZE + 512);
+                b.ptr = (unsigned char*)g_allocator.allocate_frame(b.size);
+                CHECK(b.ptr != nullptr, "allocate_frame(%zu) failed", b.size);
+                if (b.ptr == nullptr) continue;
+                b.frame = true;
+            } else {
+                b.ptr = (unsigned char*)g_allocator.allocate(b.size);
+                CHECK(b.ptr != nullptr, "allocate(%zu) failed", b.size);
+                if (b.ptr == nullptr) continue;
+            }
+            CHECK((uintptr_t)b.ptr % 8 == 0, "block %p is not 8-byte aligned", (void*)b.ptr);
+            addRange(b);
+            fillBlock(b);
+        } else if (action < 40 && !b.frame) {
+            // Resize, keeping the common prefix.
+            size_t new_size = randomSize(rng);
+            checkBlock(b);
+            removeRange(b);
+            unsigned char* moved = (unsigned char*)g_allocator.reallocate(b.ptr, new_size);
+            CHECK(moved != nullptr, "reallocate(%zu -> %zu) failed", b.size, new_size);
+            if (moved == nullptr) {
+                addRange(b);
+                continue;
+            }
+            size_t old_size = b.size;
+            b.ptr = moved;
+            b.size = new_size;
+            checkBlock(b, old_size);
+            addRange(b);
+            if (new_size > old_size) fillBlock(b, old_size);
+        } else if (action < 50 && pushHandoff(b)) {
+            b = LiveBlock{};
+        } else {
+            freeBlock(b);
+        }
+
+        // Free a block handed over by another thread.
+        if (action % 4 == 0) {
+            LiveBlock other;
+            if (popHandoff(&other)) freeBlock(other);
+        }
+
+        // Allocate, check or free a movable object.
+        if (op % 4 == 2) {
+            Movable& m = movables[rng() % MOVABLE_SLOTS];
+            if (!m.handle) {
+                m.size = rng() % 16 == 0 ? randomSize(rng) : 1 + rng() % MAX_SMALL_ALLOC_SIZE;
+                m.id = nextId(thread, id_counter);
+                m.handle = g_allocator.allocate_movable(m.size);
+                CHECK(m.handle, "allocate_movable(%zu) failed", m.size);
+                if (m.handle) {
+                    Block b{g_allocator.pin<unsigned char>(m.handle), m.size, m.id};
+                    fillBlock(b);
+                    g_allocator.unpin(m.handle);
+                }
+            } else {
+                checkMovable(m);
+                if (rng() % 2 == 0) {
+                    g_allocator.deallocate_movable(m.handle);
+                    m = Movable{};
+                }
+            }
+        }
+
+        // Occasionally cycle a batch of one small size.
+        if (op % 1024 == 0) {
+            const size_t batch = 64;
+            size_t size = 1 + rng() % MAX_SMALL_ALLOC_SIZE;
+            void* ptrs[batch];
+            size_t got = g_allocator.allocate_batch(size, batch, ptrs);
+            CHECK(got == batch, "allocate_batch returned %zu of %zu", got, batch);
+            std::vector<Block> blocks(got);
+            for (size_t i = 0; i < got; ++i) {
+                blocks[i] = {(unsigned char*)ptrs[i], size, nextId(thread, id_counter)};
+                addRange(blocks[i]);
+                fillBlock(blocks[i]);
+            }
+            for (size_t i = 0; i < got; ++i) {
+                checkBlock(blocks[i], size);
+                removeRange(blocks[i]);
+            }
+            g_allocator.deallocate_batch(ptrs, got);
+        }
+
+        // Trim under load, alternately releasing everything and keeping 1 MB.
+        if (thread == 0 && op % 2048 == 1024) g_allocator.trim(op % 4096 == 1024 ? 0 : 1 << 20);
+        if (thread == 0 && op % 512 == 256) g_allocator.compact();
+    }
+
+    for (LiveBlock& b : slots) {
+        if (b.ptr) freeBlock(b);
+    }
+    for (Movable& m : movables) {
+        if (!m.handle) continue;
+        checkMovable(m);
+        g_allocator.deallocate_movable(m.handle);
+    }
+}
+
+// --- Oversized Requests ---
+// Sizes near SIZE_MAX must fail rather than wrap to a one-page span, and a
+// reallocate to one must leave the old block intact. A cached large span is
+// left around first, so a wrapped request would be handed that span instead
+// of failing in mmap. Runs on its own thread, whose exit hands the cached
+// span on to the central cache for the leak check.
+static void checkOversizedRequests() {
+    g_allocator.deallocate(g_allocator.allocate(40 * 1024));
+    CHECK(g_allocator.allocate(SIZE_MAX) == nullptr, "allocate(SIZE_MAX) succeeded");
+    CHECK(g_allocator.allocate_zeroed(1, SIZE_MAX - 1) == nullptr, "allocate_zeroed(1, SIZE_MAX - 1) succeeded");
+
+    // A failed reallocate must leave the block, large or small, as it was.
+    for (size_t size : {(size_t)5000, (size_t)100}) {
+        Block b{(unsigned char*)g_allocator.allocate(size), size, size};
+        CHECK(b.ptr != nullptr, "allocate(%zu) failed", size);
+        if (b.ptr == nullptr) continue;
+        fillBlock(b);
+        CHECK(g_allocator.reallocate(b.ptr, SIZE_MAX - 1) == nullptr, "reallocate(%zu -> SIZE_MAX - 1) succeeded",
+              size);
+        checkBlock(b);
+        g_allocator.deallocate(b.ptr);
+    }
+}
+
+// --- Leak Check ---
+// With no live blocks and every worker gone, each small block must be back
+// in a transfer cache or long-lived pool (or unmapped by a trim) and every
+// mapped byte accounted for by small, frame and movable spans or the large
+// span cache. Then all of it is free, so trim(0) must leave only the frame
+// spans mapped.
+static void checkEverythingReturned() {
+    MyAllocator::Stats stats = g_allocator.getStats();
+    for (size_t i = 0; i < 8; ++i) {
+        const MyAllocator::ClassStats& c = stats.classes[i];
+        CHECK(c.central_blocks + c.blocks_released == c.blocks_carved,
+              "class %zu: %llu + %llu trimmed of %llu blocks returned after thread exit",
+              SIZE_CLASSES[i], (unsigned long long)c.central_blocks,
+              (unsigned long long)c.blocks_released, (unsigned long long)c.blocks_carved);
+    }
+    CHECK(stats.movable_live_bytes == 0, "%zu bytes of movable objects still live", stats.movable_live_bytes);
+    CHECK(stats.mapped_bytes ==
+              stats.small_span_bytes + stats.large_cache_bytes + stats.frame_span_bytes + stats.movable_span_bytes,
+          "mapped %zu bytes, but small spans %zu + large cache %zu + frame spans %zu + movable spans %zu",
+          stats.mapped_bytes, stats.small_span_bytes, stats.large_cache_bytes, stats.frame_span_bytes,
+          stats.movable_span_bytes);
+
+    size_t released = g_allocator.trim(0);
+    CHECK(released == stats.mapped_bytes - stats.frame_span_bytes, "trim(0) released %zu of %zu bytes",
+          released, stats.mapped_bytes - stats.frame_span_bytes);
+    stats = g_allocator.getStats();
+    CHECK(stats.mapped_bytes == stats.frame_span_bytes && stats.small_span_bytes == 0 && stats.movable_span_bytes == 0,
+          "%zu bytes (%zu in small spans) still mapped after trim(0)",
+          stats.mapped_bytes - stats.frame_span_bytes, stats.small_span_bytes);
+}
+
+// --- Metrics Check ---
+// The rendered text must be complete, end with the OpenMetrics terminator,
+// and report the trim that just ran; a short buffer gets the full length
+// back (which may differ by a few digits, as rendering itself takes sampled
+// locks) and a NUL-terminated prefix.
+static void checkMetrics() {
+    static char text[64 << 10];
+    size_t length = g_allocator.renderMetrics(text, sizeof(text));
+    CHECK(length < sizeof(text), "metrics need %zu bytes", length);
+    CHECK(length >= 6 && strcmp(text + length - 6, "# EOF\n") == 0, "metrics do not end with # EOF");
+    CHECK(strstr(text, "\nmyalloc_trimmed_bytes_total ") != nullptr, "metrics lack myalloc_trimmed_bytes_total");
+
+    char small[64];
+    size_t required = g_allocator.renderMetrics(small, sizeof(small));
+    CHECK(required > sizeof(small) && strlen(small) == sizeof(small) - 1 &&
+              strncmp(small, text, sizeof(small) - 1) == 0,
+          "short buffer: %zu of %zu bytes reported, %zu written", required, length, strlen(small));
+}
+
+int main(int argc, char** argv) {
+    uint64_t seed = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1;
+    int threads = argc > 2 ? atoi(argv[2]) : 8;
+    int ops = argc > 3 ? atoi(argv[3]) : 20000;
+    printf("Stress test: seed=%llu threads=%d ops=%d hardened=%s\n", (unsigned long long)seed,
+           threads, ops, MyAllocator::HARDENED ? "on" : "off");
+
+    std::thread oversized(checkOversizedRequests);
+    oversized.join();
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) workers.emplace_back(worker, seed, t, ops);
+    for (auto& w : workers) w.join();
+
+    // Blocks left in the handoff queue are freed by one more short-lived thread.
+    std::thread drain([] {
+        LiveBlock b;
+        while (popHandoff(&b)) freeBlock(b);
+    });
+    drain.join();
+
+    CHECK(live_ranges.empty(), "%zu blocks still live", live_ranges.size());
+    checkEverythingReturned();
+    checkMetrics();
+
+    if (failures.load() != 0) {
+        printf("Stress test FAILED: %d check(s)\n", failures.load());
+        return 1;
+    }
+    printf("Stress test passed (%zu movable objects relocated)\n", g_allocator.getStats().movable_moves);
+    return 0;
+}
@@ -0,0 +1,52 @@
+// test_util.h
+//
+// Shared by the test programs: a CHECK macro that counts failures instead of
+// aborting, and the pattern fill that blocks are checked against before
+// they are freed or resized. Everything is inline, so the header has no
+// source file of its own.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+inline std::atomic<int> failures{0};
+
+#define CHECK(cond, ...)                                   \
+    do {                                                   \
+        if (!(cond)) {                                     \
+            fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__);                  \
+            fputc('\n', stderr);                           \
+            failures.fetch_add(1);                         \
+        }                                                  \
+    } while (0)
+
+struct Block {
+    unsigned char* ptr = nullptr;
+    size_t size = 0;
+    uint64_t id = 0;
+};
+
+// --- Pattern Fill ---
+inline unsigned char patternByte(uint64_t id, size_t offset) {
+    return (unsigned char)((id * 0x9E3779B97F4A7C15ULL >> 56) + offset * 131);
+}
+
+inline void fillBlock(const Block& b, size_t from = 0) {
+    for (size_t i = from; i < b.size; ++i) b.ptr[i] = patternByte(b.id, i);
+}
+
+// Checks the first limit bytes (all of them by default).
+inline bool checkBlock(const Block& b, size_t limit = SIZE_MAX) {
+    size_t n = std::min(b.size, limit);
+    for (size_t i = 0; i < n; ++i) {
+        if (b.ptr[i] != patternByte(b.id, i)) {
+            CHECK(false, "block %llx (%zu bytes) corrupted at offset %zu", (unsigned long long)b.id, b.size, i);
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,118 @@
+// thread_heap.cpp
+
+#include "thread_heap.h"
+#include <sys/mman.h> // For mmap, munmap
+#include <new>        // For std::nothrow
+
+ThreadHeap* make_thread_heap() {
+    return new (std::nothrow) ThreadHeap();
+}
+
+ThreadHeap::~ThreadHeap() {
+    while (chunks) {
+        Chunk* chunk = chunks;
+        chunks = chunk->next;
+        munmap(chunk, chunk->bytes);
+    }
+}
+
+ThreadHeap::Stats ThreadHeap::getStats() const {
+    Stats stats;
+    stats.mapped_bytes = mapped_bytes;
+    stats.live_blocks = live_blocks;
+    stats.remote_frees = remote_frees.load(std::memory_order_relaxed);
+    return stats;
+}
+
+// --- Chunks ---
+// Over-maps by one chunk and trims both ends to get the alignment.
+ThreadHeap::Chunk* ThreadHeap::mapChunk(size_t class_index, size_t bytes) {
+    void* mem = mmap(nullptr, bytes + CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) return nullptr;
+    uintptr_t start = ((uintptr_t)mem + CHUNK_BYTES - 1) & ~(uintptr_t)(CHUNK_BYTES - 1);
+    if (start != (uintptr_t)mem) munmap(mem, start - (uintptr_t)mem);
+    uintptr_t end = (uintptr_t)mem + bytes + CHUNK_BYTES;
+    if (end != start + bytes) munmap((void*)(start + bytes), end - start - bytes);
+
+    Chunk* chunk = (Chunk*)start;
+    chunk->heap = this;
+    chunk->class_index = class_index;
+    chunk->bytes = bytes;
+    chunk->prev = nullptr;
+    chunk->next = chunks;
+    if (chunks) chunks->prev = chunk;
+    chunks = chunk;
+    mapped_bytes += bytes;
+    return chunk;
+}
+
+void ThreadHeap::unmapChunk(Chunk* chunk) {
+    if (chunk->prev) chunk->prev->next = chunk->next;
+    else chunks = chunk->next;
+    if (chunk->next) chunk->next->prev = chunk->prev;
+    mapped_bytes -= chunk->bytes;
+    munmap(chunk, chunk->bytes);
+}
+
+// --- Allocation ---
+// Empty list: take back handed-off blocks first, then cut from the class's
+// newest chunk, mapping another when it is used up.
+void* ThreadHeap::allocateSlow(size_t class_index) {
+    if (remote.load(std::memory_order_relaxed) != nullptr) {
+        collect();
+        FreeBlock* block = lists[class_index];
+        if (block != nullptr) {
+            lists[class_index] = block->next;
+            ++live_blocks;
+            return block;
+        }
+    }
+
+    size_t block_size = SIZE_CLASSES[class_index];
+    if ((size_t)(bump_end[class_index] - bump_next[class_index]) < block_size) {
+        Chunk* chunk = mapChunk(class_index, CHUNK_BYTES);
+        if (chunk == nullptr) return nullptr;
+        bump_next[class_index] = (char*)chunk + CHUNK_HEADER;
+        bump_end[class_index] = (char*)chunk + CHUNK_BYTES;
+    }
+    void* block = bump_next[class_index];
+    bump_next[class_index] += block_size;
+    ++live_blocks;
+    return block;
+}
+
+void* ThreadHeap::allocateLarge(size_t size) {
+    if (size == 0 || size > SIZE_MAX - CHUNK_HEADER - CHUNK_BYTES) return nullptr;
+    size_t bytes = (size + CHUNK_HEADER + 4095) & ~(size_t)4095;
+    Chunk* chunk = mapChunk(LARGE_CLASS, bytes);
+    if (chunk == nullptr) return nullptr;
+    ++live_blocks;
+    return (char*)chunk + CHUNK_HEADER;
+}
+
+// --- Cross-Thread Handoff ---
+// A Treiber stack that only the owner pops, and only all at once, so a
+// pushed block can never be popped and re-pushed under a pusher (no ABA).
+void ThreadHeap::deallocate_remote(void* ptr) {
+    if (ptr == nullptr) return;
+    ThreadHeap* heap = chunkOf(ptr)->heap;
+    FreeBlock* block = (FreeBlock*)ptr;
+    FreeBlock* head = heap->remote.load(std::memory_order_relaxed);
+    do {
+        block->next = head;
+    } while (!heap->remote.compare_exchange_weak(head, block, std::memory_order_release,
+                                                 std::memory_order_relaxed));
+    heap->remote_frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t ThreadHeap::collect() {
+    FreeBlock* block = remote.exchange(nullptr, std::memory_order_acquire);
+    size_t count = 0;
+    while (block) {
+        FreeBlock* next = block->next;
+        deallocate(block);
+        block = next;
+        ++count;
+    }
+    return count;
+}
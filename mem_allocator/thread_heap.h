@@ -0,0 +1,108 @@
+// thread_heap.h
+
+#pragma once
+
+#include "allocator.h" // For the size classes
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+class ThreadHeap;
+
+// Creates a heap owned by the calling thread. Returns nullptr on failure.
+ThreadHeap* make_thread_heap();
+
+// A private heap for thread-per-core code that (almost) never frees across
+// threads. It maps its own chunks and keeps its own free lists, so
+// allocate() and deallocate() take no locks and touch no shared state.
+//
+// allocate(), deallocate(), collect() and the destructor must only be called
+// by the owning thread. Any other thread that ends up with a block hands it
+// back with deallocate_remote(), which pushes it onto a lock-free stack the
+// owner drains on its next refill or collect(). Deleting the heap unmaps
+// every block still in it.
+class ThreadHeap {
+public:
+    ~ThreadHeap();
+
+    inline void* allocate(size_t size);
+    inline void deallocate(void* ptr); // A block of another heap is handed off
+    // Cross-thread free: returns ptr to the heap it came from, from any thread.
+    static void deallocate_remote(void* ptr);
+    // Takes back the blocks other threads have handed off; returns how many.
+    size_t collect();
+
+    struct Stats {
+        size_t mapped_bytes;
+        size_t live_blocks;  // Allocated and not yet freed or collected
+        size_t remote_frees; // Blocks handed back by other threads
+    };
+    Stats getStats() const;
+
+private:
+    friend ThreadHeap* make_thread_heap();
+    ThreadHeap() = default;
+    ThreadHeap(const ThreadHeap&) = delete;
+    ThreadHeap& operator=(const ThreadHeap&) = delete;
+
+    // Every chunk is CHUNK_BYTES-aligned and starts with its header, so any
+    // block finds its chunk, heap and size class by masking its address.
+    // Large blocks get a chunk of their own.
+    static constexpr size_t CHUNK_BYTES = 64 << 10;
+    static constexpr size_t CHUNK_HEADER = 64;
+    static constexpr size_t LARGE_CLASS = 8;
+
+    struct Chunk {
+        ThreadHeap* heap;   // Immutable: the only field other threads read
+        size_t class_index; // LARGE_CLASS for a large block
+        size_t bytes;       // Mapping size
+        Chunk* prev;        // The heap's chunk list
+        Chunk* next;
+    };
+    static_assert(sizeof(Chunk) <= CHUNK_HEADER, "chunk header overflows");
+
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static Chunk* chunkOf(const void* ptr) {
+        return (Chunk*)((uintptr_t)ptr & ~(uintptr_t)(CHUNK_BYTES - 1));
+    }
+    Chunk* mapChunk(size_t class_index, size_t bytes);
+    void unmapChunk(Chunk* chunk);
+    void* allocateSlow(size_t class_index);
+    void* allocateLarge(size_t size);
+
+    FreeBlock* lists[8] = {};
+    char* bump_next[8] = {}; // Uncut part of each class's newest chunk
+    char* bump_end[8] = {};
+    Chunk* chunks = nullptr;
+    size_t mapped_bytes = 0;
+    size_t live_blocks = 0;
+
+    // Written by other threads: kept off the owner's line.
+    alignas(64) std::atomic<FreeBlock*> remote{nullptr};
+    std::atomic<size_t> remote_frees{0};
+};
+
+// --- Inline Fast Path ---
+inline void* ThreadHeap::allocate(size_t size) {
+    if (size - 1 >= MAX_SMALL_ALLOC_SIZE) return allocateLarge(size);
+    size_t index = MyAllocator::getSizeClassIndex(size);
+    FreeBlock* block = lists[index];
+    if (__builtin_expect(block == nullptr, 0)) return allocateSlow(index);
+    lists[index] = block->next;
+    ++live_blocks;
+    return block;
+}
+
+inline void ThreadHeap::deallocate(void* ptr) {
+    if (ptr == nullptr) return;
+    Chunk* chunk = chunkOf(ptr);
+    if (__builtin_expect(chunk->heap != this, 0)) return deallocate_remote(ptr);
+    --live_blocks;
+    if (chunk->class_index == LARGE_CLASS) return unmapChunk(chunk);
+    FreeBlock* block = (FreeBlock*)ptr;
+    block->next = lists[chunk->class_index];
+    lists[chunk->class_index] = block;
+}
@@ -0,0 +1,132 @@
+// thread_heap_test.cpp
+//
+// Multi-threaded test for ThreadHeap. Every thread owns a heap and runs a
+// seeded random mix of small and large allocations and frees on it, with
+// pattern-filled blocks checked before they are freed. Some blocks are
+// handed to another thread, which frees them either through
+// ThreadHeap::deallocate_remote or through its own heap's deallocate (which
+// must notice the block is foreign and hand it off too). After the threads
+// exit, the main thread collects the handed-off blocks into each heap, and
+// every heap must be empty.
+//
+// Usage: thread_heap_test [seed] [threads] [ops-per-thread]
+
+#include "thread_heap.h"
+#include "test_util.h"
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+const int LIVE_SLOTS = 256;
+const size_t MAX_LARGE_SIZE = 200 * 1024;
+
+static std::atomic<size_t> handed_off{0};
+
+// --- Cross-Thread Handoff ---
+// One inbox per thread; the test's own locking, not the heap's.
+struct Inbox {
+    std::mutex mtx;
+    std::vector<Block> blocks;
+};
+static std::vector<Inbox> inboxes;
+
+static void worker(ThreadHeap* heap, uint64_t seed, int thread, int threads, int ops) {
+    std::mt19937_64 rng(seed * 1000003 + thread);
+    std::vector<Block> slots(LIVE_SLOTS);
+    uint64_t id_counter = 0;
+
+    for (int op = 0; op < ops; ++op) {
+        Block& b = slots[rng() % LIVE_SLOTS];
+        unsigned action = rng() % 100;
+        if (b.ptr == nullptr) {
+            b.size = action < 90 ? 1 + rng() % MAX_SMALL_ALLOC_SIZE : 1 + rng() % MAX_LARGE_SIZE;
+            b.id = ((uint64_t)thread << 40) | ++id_counter;
+            b.ptr = (unsigned char*)heap->allocate(b.size);
+            CHECK(b.ptr != nullptr, "allocate(%zu) failed", b.size);
+            if (b.ptr == nullptr) continue;
+            fillBlock(b);
+        } else if (action < 5) {
+            Inbox& inbox = inboxes[(thread + 1 + rng() % (threads - 1)) % threads];
+            std::lock_guard<std::mutex> lock(inbox.mtx);
+            inbox.blocks.push_back(b);
+            b = Block{};
+        } else {
+            checkBlock(b);
+            heap->deallocate(b.ptr);
+            b = Block{};
+        }
+
+        // Free what other threads handed over, half each way.
+        if (op % 64 == 0) {
+            std::vector<Block> received;
+            {
+                std::lock_guard<std::mutex> lock(inboxes[thread].mtx);
+                received.swap(inboxes[thread].blocks);
+            }
+            for (Block& r : received) {
+                checkBlock(r);
+                if (r.id & 1) ThreadHeap::deallocate_remote(r.ptr);
+                else heap->deallocate(r.ptr);
+            }
+            handed_off.fetch_add(received.size());
+        }
+    }
+    for (Block& b : slots) {
+        if (b.ptr) {
+            checkBlock(b);
+            heap->deallocate(b.ptr);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t seed = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1;
+    int threads = argc > 2 ? atoi(argv[2]) : 8;
+    int ops = argc > 3 ? atoi(argv[3]) : 20000;
+    if (threads < 2) threads = 2;
+    printf("Thread heap test: seed=%llu threads=%d ops=%d\n", (unsigned long long)seed, threads, ops);
+
+    inboxes = std::vector<Inbox>(threads);
+    std::vector<ThreadHeap*> heaps(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&heaps, seed, t, threads, ops] {
+            heaps[t] = make_thread_heap();
+            CHECK(heaps[t] != nullptr, "make_thread_heap failed");
+            if (heaps[t]) worker(heaps[t], seed, t, threads, ops);
+        });
+    }
+    for (auto& w : workers) w.join();
+
+    // The workers are gone, so the main thread now owns every heap. Blocks
+    // still in the inboxes are handed back from here.
+    for (Inbox& inbox : inboxes) {
+        for (Block& b : inbox.blocks) {
+            checkBlock(b);
+            ThreadHeap::deallocate_remote(b.ptr);
+        }
+        handed_off.fetch_add(inbox.blocks.size());
+    }
+
+    size_t remote_frees = 0;
+    for (ThreadHeap* heap : heaps) {
+        if (heap == nullptr) continue;
+        heap->collect();
+        ThreadHeap::Stats stats = heap->getStats();
+        CHECK(stats.live_blocks == 0, "%zu blocks still live after collect()", stats.live_blocks);
+        remote_frees += stats.remote_frees;
+        delete heap;
+    }
+    CHECK(remote_frees == handed_off.load(), "%zu remote frees for %zu handed-off blocks", remote_frees,
+          handed_off.load());
+
+    if (failures.load() != 0) {
+        printf("Thread heap test FAILED: %d check(s)\n", failures.load());
+        return 1;
+    }
+    printf("Thread heap test passed (%zu cross-thread frees)\n", remote_frees);
+    return 0;
+}